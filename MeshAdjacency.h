@@ -0,0 +1,128 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <algorithm>
+#include <Eigen/Eigen>
+#include <igl/parallel_for.h>
+#include "MeshRemap.h"
+
+// Connectivity of a remapped mesh in flat 32-bit arrays.
+//
+// Edge j of face i runs from F(i, j) to F(i, (j + 1) % 3).
+struct MeshAdjacency
+{
+	// faces around vertex v: VF[VFStart[v]] .. VF[VFStart[v + 1] - 1], ascending
+	std::vector<int32_t> VFStart, VF;
+	// neighbour of face i across edge j at FF[3 * i + j], -1 on open borders
+	// and UV seams (the remapped vertices are not shared there)
+	std::vector<int32_t> FF;
+	// one entry per UV seam edge, 4 values: face, edge, opposite face, opposite
+	// edge. Vertex F(face, edge) has the same position as F(opposite, (opposite edge + 1) % 3).
+	std::vector<int32_t> SeamEdges;
+};
+
+// Build the adjacency of a remapped mesh in parallel. Seams are found through
+// VNew2VOld: a border edge whose original positions are shared with another
+// border edge is a UV seam. Without the maps only VF and FF are filled.
+inline void buildAdjacency(const MatrixMesh& mesh_cpu, MeshAdjacency& adj)
+{
+	const auto& F = mesh_cpu.F;
+	const int nv = (int)mesh_cpu.V.rows();
+	const int nf = (int)F.rows();
+
+	// vertex -> faces
+	{
+		std::unique_ptr<std::atomic<int32_t>[]> cursor(new std::atomic<int32_t>[nv + 1]);
+		igl::parallel_for(nv + 1, [&](int v) { cursor[v].store(0, std::memory_order_relaxed); }, 100000);
+		igl::parallel_for(nf, [&](int i) {
+			for (int j = 0; j < 3; j++) {
+				cursor[F(i, j) + 1].fetch_add(1, std::memory_order_relaxed);
+			}
+		}, 100000);
+		adj.VFStart.resize(nv + 1);
+		adj.VFStart[0] = 0;
+		for (int v = 0; v < nv; v++) {
+			adj.VFStart[v + 1] = adj.VFStart[v] + cursor[v + 1].load(std::memory_order_relaxed);
+		}
+		igl::parallel_for(nv, [&](int v) { cursor[v].store(adj.VFStart[v], std::memory_order_relaxed); }, 100000);
+		adj.VF.resize(3 * (size_t)nf);
+		igl::parallel_for(nf, [&](int i) {
+			for (int j = 0; j < 3; j++) {
+				adj.VF[cursor[F(i, j)].fetch_add(1, std::memory_order_relaxed)] = i;
+			}
+		}, 100000);
+		// the fill order depends on scheduling, sort each ring
+		igl::parallel_for(nv, [&](int v) {
+			std::sort(adj.VF.begin() + adj.VFStart[v], adj.VF.begin() + adj.VFStart[v + 1]);
+		}, 10000);
+	}
+
+	// face -> faces: the face holding the reversed edge (b, a)
+	adj.FF.assign(3 * (size_t)nf, -1);
+	igl::parallel_for(nf, [&](int i) {
+		for (int j = 0; j < 3; j++) {
+			int a = F(i, j), b = F(i, (j + 1) % 3);
+			for (int k = adj.VFStart[b]; k < adj.VFStart[b + 1] && adj.FF[3 * i + j] < 0; k++) {
+				int g = adj.VF[k];
+				if (g == i) { continue; }
+				for (int l = 0; l < 3; l++) {
+					if (F(g, l) == b && F(g, (l + 1) % 3) == a) {
+						adj.FF[3 * i + j] = g;
+						break;
+					}
+				}
+			}
+		}
+	}, 10000);
+
+	adj.SeamEdges.clear();
+	const auto& map = mesh_cpu.VNew2VOld;
+	if ((int)map.size() != nv) {
+		return;
+	}
+
+	// new vertices of every original position
+	int n_old = 0;
+	for (int v = 0; v < nv; v++) { n_old = std::max(n_old, map[v] + 1); }
+	std::vector<int32_t> old_start(n_old + 1, 0), old_verts(nv);
+	for (int v = 0; v < nv; v++) { old_start[map[v] + 1]++; }
+	for (int o = 0; o < n_old; o++) { old_start[o + 1] += old_start[o]; }
+	{
+		std::vector<int32_t> fill(old_start.begin(), old_start.end() - 1);
+		for (int v = 0; v < nv; v++) { old_verts[fill[map[v]]++] = v; }
+	}
+
+	// opposite half edge of every border edge, encoded as 3 * face + edge
+	std::vector<int32_t> opposite(3 * (size_t)nf, -1);
+	igl::parallel_for(nf, [&](int i) {
+		for (int j = 0; j < 3; j++) {
+			if (adj.FF[3 * i + j] >= 0) { continue; }
+			int A = map[F(i, j)], B = map[F(i, (j + 1) % 3)];
+			for (int s = old_start[B]; s < old_start[B + 1] && opposite[3 * i + j] < 0; s++) {
+				int b = old_verts[s];
+				for (int k = adj.VFStart[b]; k < adj.VFStart[b + 1]; k++) {
+					int g = adj.VF[k];
+					if (g == i) { continue; }
+					int l = F(g, 0) == b ? 0 : (F(g, 1) == b ? 1 : 2);
+					if (map[F(g, (l + 1) % 3)] == A && adj.FF[3 * g + l] < 0) {
+						opposite[3 * i + j] = 3 * g + l;
+						break;
+					}
+				}
+			}
+		}
+	}, 10000);
+
+	// every seam once, from the side with the lower half edge
+	for (int h = 0; h < 3 * nf; h++) {
+		int o = opposite[h];
+		if (o > h) {
+			adj.SeamEdges.push_back(h / 3);
+			adj.SeamEdges.push_back(h % 3);
+			adj.SeamEdges.push_back(o / 3);
+			adj.SeamEdges.push_back(o % 3);
+		}
+	}
+}
@@ -0,0 +1,126 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <future>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include "OBJ_Loader.h"
+#include "MeshRemap.h"
+#include "MeshValidate.h"
+#include "TaskControl.h"
+
+// Runs a job: the caller's thread pool, job system, ...
+typedef std::function<void(std::function<void()>)> Executor;
+
+// Shared cancel flag; keeps living inside the task if the caller drops it
+typedef std::shared_ptr<std::atomic<bool>> CancelToken;
+
+inline CancelToken makeCancelToken()
+{
+	return std::make_shared<std::atomic<bool>>(false);
+}
+
+// Executor that starts a detached thread per job
+inline Executor threadExecutor()
+{
+	return [](std::function<void()> job) { std::thread(std::move(job)).detach(); };
+}
+
+enum class TaskStatus
+{
+	Done,
+	Failed,
+	Cancelled,
+};
+
+struct AsyncMesh
+{
+	TaskStatus status = TaskStatus::Failed;
+	MatrixMesh mesh;
+	// LoadAsync: material names, indexed by mesh.FM
+	std::vector<std::string> material_names;
+};
+
+namespace async_internal
+{
+	template <typename Fn>
+	inline std::future<AsyncMesh> schedule(const Executor& executor, Fn fn)
+	{
+		auto task = std::make_shared<std::packaged_task<AsyncMesh()>>(std::move(fn));
+		std::future<AsyncMesh> result = task->get_future();
+		executor([task]() { (*task)(); });
+		return result;
+	}
+}
+
+// Load an OBJ on executor into a MatrixMesh with every mesh of the file
+// concatenated (not remapped yet). progress receives the fraction of the
+// file parsed; setting *cancel stops the parse at its next checkpoint.
+inline std::future<AsyncMesh> LoadAsync(const Executor& executor, const std::string& path,
+	CancelToken cancel = nullptr, std::function<void(float)> progress = nullptr)
+{
+	return async_internal::schedule(executor, [path, cancel, progress]() {
+		AsyncMesh result;
+		TaskControl control;
+		control.cancel = cancel.get();
+		control.progress = progress;
+		if (control.Cancelled()) {
+			result.status = TaskStatus::Cancelled;
+			return result;
+		}
+		objl::Loader loader;
+		if (!loader.LoadFile(path, &control)) {
+			result.status = control.Cancelled() ? TaskStatus::Cancelled : TaskStatus::Failed;
+			return result;
+		}
+		loader.GetLoadedVerts(result.mesh.V, result.mesh.N, result.mesh.TC);
+		loader.GetLoadedColors(result.mesh.C);
+		loader.GetAllTriangleIndices(result.mesh.F, result.mesh.FTC, result.mesh.FN, result.mesh.FM);
+		loader.GetAllPolygonIndices(result.mesh.FP);
+		result.material_names = std::move(loader.MaterialNames);
+		result.status = TaskStatus::Done;
+		return result;
+	});
+}
+
+// Remap mesh (taken over by the task) on executor. The mesh is validated and
+// sanitized first; the task fails if it cannot be fixed. Colors in C are
+// remapped with the vertices. low_memory selects the remapMeshLowMemory
+// behaviour (normals and FTC freed early, no pooled buffers).
+inline std::future<AsyncMesh> RemapAsync(const Executor& executor, MatrixMesh mesh, bool low_memory = false,
+	CancelToken cancel = nullptr, std::function<void(float)> progress = nullptr)
+{
+	auto owned = std::make_shared<MatrixMesh>(std::move(mesh));
+	return async_internal::schedule(executor, [owned, low_memory, cancel, progress]() {
+		AsyncMesh result;
+		TaskControl control;
+		control.cancel = cancel.get();
+		control.progress = progress;
+		if (control.Cancelled()) {
+			result.status = TaskStatus::Cancelled;
+			return result;
+		}
+		ValidationReport report;
+		if (!validateMesh(*owned, report) && !sanitizeMesh(*owned, report)) {
+			result.status = TaskStatus::Failed;
+			return result;
+		}
+		result.mesh = std::move(*owned);
+		bool done;
+		if (result.mesh.C.rows() > 0) {
+			done = remapMeshWithColors(result.mesh, &control, low_memory);
+		}
+		else {
+			done = low_memory ? remapMeshLowMemory(result.mesh, &control) : remapMesh(result.mesh, &control);
+		}
+		if (!done) {
+			result.mesh = MatrixMesh();
+			result.status = TaskStatus::Cancelled;
+			return result;
+		}
+		result.status = TaskStatus::Done;
+		return result;
+	});
+}
@@ -0,0 +1,237 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include <Eigen/Eigen>
+#include <igl/parallel_for.h>
+#include "MeshRemap.h"
+
+// Texel maps of a remapped mesh. Row 0 is v = 0, texel (x, y) samples
+// uv = ((x + 0.5) / width, (y + 0.5) / height).
+struct BakeMaps
+{
+	int width = 0, height = 0;
+	// 3 floats per texel
+	std::vector<float> position, normal;
+	// covering triangle, -1 for empty texels
+	std::vector<int> triangle;
+	// 1 for texels filled by gutter dilation
+	std::vector<unsigned char> dilated;
+};
+
+namespace bake_internal
+{
+	const int TileSize = 64;
+
+	inline void dilate(BakeMaps& maps, int passes)
+	{
+		const int w = maps.width, h = maps.height;
+		std::vector<int> src(w * (size_t)h);
+		for (int pass = 0; pass < passes; pass++) {
+			// texel each empty texel copies from, decided against the previous pass
+			igl::parallel_for(h, [&](int y) {
+				for (int x = 0; x < w; x++) {
+					size_t t = (size_t)y * w + x;
+					src[t] = -1;
+					if (maps.triangle[t] >= 0) {
+						continue;
+					}
+					for (int dy = -1; dy <= 1 && src[t] < 0; dy++) {
+						for (int dx = -1; dx <= 1; dx++) {
+							int nx = x + dx, ny = y + dy;
+							if (nx < 0 || ny < 0 || nx >= w || ny >= h) { continue; }
+							size_t n = (size_t)ny * w + nx;
+							if (maps.triangle[n] >= 0) {
+								src[t] = (int)n;
+								break;
+							}
+						}
+					}
+				}
+			}, 16);
+			bool changed = false;
+			for (size_t t = 0; t < src.size(); t++) {
+				if (src[t] < 0) { continue; }
+				size_t n = src[t];
+				for (int c = 0; c < 3; c++) {
+					maps.position[3 * t + c] = maps.position[3 * n + c];
+					maps.normal[3 * t + c] = maps.normal[3 * n + c];
+				}
+				maps.triangle[t] = maps.triangle[n];
+				maps.dilated[t] = 1;
+				changed = true;
+			}
+			if (!changed) {
+				break;
+			}
+		}
+	}
+}
+
+// Rasterize every triangle of the remapped mesh in UV space and store the
+// interpolated position, normal and triangle id per texel.
+//
+// Triangles are binned into 64x64 tiles and the tiles are rasterized in
+// parallel. Edge functions are evaluated four texels at a time (Array4f,
+// vectorized by Eigen), and overlapping triangles resolve to the highest id,
+// so the result does not depend on scheduling. gutter > 0 grows the charts
+// by that many texels afterwards.
+inline void bakeUVMaps(const MatrixMesh& mesh_cpu, int width, int height, BakeMaps& maps, int gutter = 0)
+{
+	const auto& V = mesh_cpu.V;
+	const auto& N = mesh_cpu.N;
+	const auto& TC = mesh_cpu.TC;
+	const auto& F = mesh_cpu.F;
+	const int nf = (int)F.rows();
+	const bool has_normals = N.rows() == V.rows();
+
+	maps.width = width;
+	maps.height = height;
+	maps.position.assign(3 * (size_t)width * height, 0.0f);
+	maps.normal.assign(3 * (size_t)width * height, 0.0f);
+	maps.triangle.assign((size_t)width * height, -1);
+	maps.dilated.assign((size_t)width * height, 0);
+
+	const int tiles_x = (width + bake_internal::TileSize - 1) / bake_internal::TileSize;
+	const int tiles_y = (height + bake_internal::TileSize - 1) / bake_internal::TileSize;
+	const int n_tiles = tiles_x * tiles_y;
+
+	// texel-space bounding box of every triangle, clamped to the image
+	Eigen::MatrixXi bbox(nf, 4);
+	igl::parallel_for(nf, [&](int i) {
+		double x0 = 1e30, y0 = 1e30, x1 = -1e30, y1 = -1e30;
+		for (int j = 0; j < 3; j++) {
+			double x = TC(F(i, j), 0) * width - 0.5, y = TC(F(i, j), 1) * height - 0.5;
+			x0 = std::min(x0, x); x1 = std::max(x1, x);
+			y0 = std::min(y0, y); y1 = std::max(y1, y);
+		}
+		bbox(i, 0) = std::max(0, (int)std::ceil(x0));
+		bbox(i, 1) = std::max(0, (int)std::ceil(y0));
+		bbox(i, 2) = std::min(width - 1, (int)std::floor(x1));
+		bbox(i, 3) = std::min(height - 1, (int)std::floor(y1));
+	}, 10000);
+
+	// tile -> triangles, in increasing triangle order
+	auto tile_range = [&](int i, int& tx0, int& ty0, int& tx1, int& ty1) {
+		tx0 = bbox(i, 0) / bake_internal::TileSize;
+		ty0 = bbox(i, 1) / bake_internal::TileSize;
+		tx1 = bbox(i, 2) / bake_internal::TileSize;
+		ty1 = bbox(i, 3) / bake_internal::TileSize;
+		return bbox(i, 0) <= bbox(i, 2) && bbox(i, 1) <= bbox(i, 3);
+	};
+	std::vector<int> tile_start(n_tiles + 1, 0);
+	for (int i = 0; i < nf; i++) {
+		int tx0, ty0, tx1, ty1;
+		if (!tile_range(i, tx0, ty0, tx1, ty1)) { continue; }
+		for (int ty = ty0; ty <= ty1; ty++) {
+			for (int tx = tx0; tx <= tx1; tx++) { tile_start[ty * tiles_x + tx + 1]++; }
+		}
+	}
+	for (int t = 0; t < n_tiles; t++) {
+		tile_start[t + 1] += tile_start[t];
+	}
+	std::vector<int> tile_tris(tile_start[n_tiles]);
+	{
+		std::vector<int> fill(tile_start.begin(), tile_start.end() - 1);
+		for (int i = 0; i < nf; i++) {
+			int tx0, ty0, tx1, ty1;
+			if (!tile_range(i, tx0, ty0, tx1, ty1)) { continue; }
+			for (int ty = ty0; ty <= ty1; ty++) {
+				for (int tx = tx0; tx <= tx1; tx++) { tile_tris[fill[ty * tiles_x + tx]++] = i; }
+			}
+		}
+	}
+
+	const Eigen::Array4f lane(0.0f, 1.0f, 2.0f, 3.0f);
+	igl::parallel_for(n_tiles, [&](int t) {
+		const int x_begin = (t % tiles_x) * bake_internal::TileSize;
+		const int y_begin = (t / tiles_x) * bake_internal::TileSize;
+		const int x_end = std::min(width, x_begin + bake_internal::TileSize);
+		const int y_end = std::min(height, y_begin + bake_internal::TileSize);
+
+		for (int k = tile_start[t]; k < tile_start[t + 1]; k++) {
+			const int i = tile_tris[k];
+			// texel-space corners; texel centers sit on integer coordinates
+			float px[3], py[3];
+			for (int j = 0; j < 3; j++) {
+				px[j] = float(TC(F(i, j), 0) * width - 0.5);
+				py[j] = float(TC(F(i, j), 1) * height - 0.5);
+			}
+			float area = (px[1] - px[0]) * (py[2] - py[0]) - (py[1] - py[0]) * (px[2] - px[0]);
+			if (area == 0) { continue; }
+			const float inv_area = 1.0f / area;
+			// edge j is opposite corner j: E_j(x, y) = a_j * x + b_j * y + c_j
+			float a[3], b[3], c[3];
+			for (int j = 0; j < 3; j++) {
+				int p = (j + 1) % 3, q = (j + 2) % 3;
+				a[j] = (py[p] - py[q]) * inv_area;
+				b[j] = (px[q] - px[p]) * inv_area;
+				c[j] = (px[p] * py[q] - px[q] * py[p]) * inv_area;
+			}
+			Eigen::Vector3f pos[3], nor[3];
+			for (int j = 0; j < 3; j++) {
+				pos[j] = V.row(F(i, j)).transpose().cast<float>();
+				nor[j] = has_normals ? Eigen::Vector3f(N.row(F(i, j)).transpose().cast<float>()) : Eigen::Vector3f::Zero();
+			}
+
+			const int x0 = std::max(x_begin, bbox(i, 0)), x1 = std::min(x_end - 1, bbox(i, 2));
+			const int y0 = std::max(y_begin, bbox(i, 1)), y1 = std::min(y_end - 1, bbox(i, 3));
+			for (int y = y0; y <= y1; y++) {
+				for (int x = x0; x <= x1; x += 4) {
+					Eigen::Array4f xs = lane + float(x);
+					Eigen::Array4f w0 = a[0] * xs + (b[0] * y + c[0]);
+					Eigen::Array4f w1 = a[1] * xs + (b[1] * y + c[1]);
+					Eigen::Array4f w2 = a[2] * xs + (b[2] * y + c[2]);
+					Eigen::Array4f inside = w0.min(w1).min(w2);
+					if ((inside < 0.0f).all()) { continue; }
+					for (int l = 0; l < 4 && x + l <= x1; l++) {
+						if (inside[l] < 0.0f) { continue; }
+						size_t texel = (size_t)y * width + x + l;
+						Eigen::Vector3f p = w0[l] * pos[0] + w1[l] * pos[1] + w2[l] * pos[2];
+						Eigen::Vector3f n = w0[l] * nor[0] + w1[l] * nor[1] + w2[l] * nor[2];
+						float len = n.norm();
+						if (len > 0) { n /= len; }
+						for (int d = 0; d < 3; d++) {
+							maps.position[3 * texel + d] = p[d];
+							maps.normal[3 * texel + d] = n[d];
+						}
+						maps.triangle[texel] = i;
+					}
+				}
+			}
+		}
+	}, 1);
+
+	if (gutter > 0) {
+		bake_internal::dilate(maps, gutter);
+	}
+}
+
+// Write a 1 or 3 channel float image as PFM (rows bottom to top, matching BakeMaps)
+inline bool writePFM(const std::string& path, const std::vector<float>& data, int width, int height, int channels)
+{
+	FILE* fp = fopen(path.c_str(), "wb");
+	if (!fp) {
+		return false;
+	}
+	// negative scale: little endian
+	fprintf(fp, "%s\n%d %d\n-1.0\n", channels == 3 ? "PF" : "Pf", width, height);
+	size_t n = (size_t)width * height * channels;
+	bool ok = fwrite(data.data(), sizeof(float), n, fp) == n;
+	fclose(fp);
+	return ok;
+}
+
+// Write the triangle id map as raw little endian int32, row 0 first
+inline bool writeTriangleMap(const std::string& path, const BakeMaps& maps)
+{
+	FILE* fp = fopen(path.c_str(), "wb");
+	if (!fp) {
+		return false;
+	}
+	bool ok = fwrite(maps.triangle.data(), sizeof(int), maps.triangle.size(), fp) == maps.triangle.size();
+	fclose(fp);
+	return ok;
+}
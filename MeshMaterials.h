@@ -0,0 +1,72 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <Eigen/Eigen>
+#include <igl/parallel_for.h>
+#include "MeshRemap.h"
+
+// One draw call of a material-sorted index buffer, in faces of F
+struct DrawRange
+{
+	int material;
+	int first_face;
+	int face_count;
+};
+
+// Stable counting sort of the faces by FM so every material occupies one
+// contiguous range of F (and FTC / FN / FP). Faces without a material (-1) come
+// first. ranges receives one entry per material that has faces.
+inline void sortFacesByMaterial(MatrixMesh& mesh_cpu, std::vector<DrawRange>& ranges)
+{
+	ranges.clear();
+	const int nf = (int)mesh_cpu.F.rows();
+	if (mesh_cpu.FM.size() != nf) {
+		ranges.push_back({ -1, 0, nf });
+		return;
+	}
+	const int n_mat = nf > 0 ? std::max(0, mesh_cpu.FM.maxCoeff()) + 1 : 0;
+
+	// bucket 0 holds the faces without material
+	std::vector<int> start(n_mat + 2, 0);
+	for (int i = 0; i < nf; i++) {
+		start[mesh_cpu.FM[i] + 2]++;
+	}
+	for (int m = 0; m <= n_mat; m++) {
+		if (start[m + 1] > 0) {
+			ranges.push_back({ m - 1, start[m], start[m + 1] });
+		}
+		start[m + 1] += start[m];
+	}
+
+	std::vector<int> order(nf);
+	{
+		std::vector<int> fill(start.begin(), start.end() - 1);
+		for (int i = 0; i < nf; i++) {
+			order[fill[mesh_cpu.FM[i] + 1]++] = i;
+		}
+	}
+
+	auto reorder = [&](Eigen::MatrixXi& M) {
+		if (M.rows() != nf) {
+			return;
+		}
+		Eigen::MatrixXi sorted(nf, M.cols());
+		igl::parallel_for(nf, [&](int i) { sorted.row(i) = M.row(order[i]); }, 10000);
+		M = std::move(sorted);
+	};
+	reorder(mesh_cpu.F);
+	reorder(mesh_cpu.FTC);
+	reorder(mesh_cpu.FN);
+	auto reorderVector = [&](Eigen::VectorXi& v) {
+		if (v.size() != nf) {
+			return;
+		}
+		Eigen::VectorXi sorted(nf);
+		for (int i = 0; i < nf; i++) {
+			sorted[i] = v[order[i]];
+		}
+		v = std::move(sorted);
+	};
+	reorderVector(mesh_cpu.FM);
+	reorderVector(mesh_cpu.FP);
+}
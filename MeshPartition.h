@@ -0,0 +1,188 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <Eigen/Eigen>
+#include <igl/parallel_for.h>
+#include "MeshRemap.h"
+
+// One draw call of a PartitionedMesh16
+struct Submesh16
+{
+	// rows of PartitionedMesh16::V / TC / N / T / C used by this part
+	int first_vertex, vertex_count;
+	// entries of PartitionedMesh16::Indices, relative to first_vertex
+	int first_index, index_count;
+	// FM of the faces, -1 without materials
+	int material;
+};
+
+// Remapped mesh cut into parts that each fit a 16-bit index buffer.
+// Vertices on the border of two parts are stored once per part.
+struct PartitionedMesh16
+{
+	Eigen::MatrixXd V, TC, N;
+	// empty when the remapped mesh has no tangents / colors
+	Eigen::MatrixXd T, C;
+	// source row (in the remapped mesh) of every vertex
+	std::vector<int32_t> VSource;
+	std::vector<uint16_t> Indices;
+	// source face of every triangle
+	std::vector<int32_t> FSource;
+	std::vector<Submesh16> Parts;
+	// vertices added by the split (rows of V minus distinct source rows)
+	int Duplicated = 0;
+};
+
+namespace partition_internal
+{
+	// interleave five 12-bit coordinates
+	inline uint64_t morton5(const int q[5])
+	{
+		uint64_t key = 0;
+		for (int b = 0; b < 12; b++) {
+			for (int d = 0; d < 5; d++) {
+				key |= uint64_t((q[d] >> b) & 1) << (5 * b + d);
+			}
+		}
+		return key;
+	}
+}
+
+// Partition the remapped mesh into parts of at most max_vertices vertices.
+//
+// Faces are ordered along a Morton curve over their centroid in position
+// and UV space, so each part is compact on the surface and in the texture;
+// the UV term also keeps faces that share remapped vertices together. Faces
+// with different FM never share a part. Parts are then filled greedily
+// along that order and gathered in parallel.
+inline void partitionMesh16(const MatrixMesh& mesh_cpu, PartitionedMesh16& out, int max_vertices = 65535)
+{
+	const auto& V = mesh_cpu.V;
+	const auto& TC = mesh_cpu.TC;
+	const auto& F = mesh_cpu.F;
+	const int nv = (int)V.rows();
+	const int nf = (int)F.rows();
+	const bool has_materials = mesh_cpu.FM.size() == nf;
+	max_vertices = std::max(3, std::min(max_vertices, 65535));
+
+	// sort key: material, then Morton code
+	Eigen::RowVector3d pmin = nv ? Eigen::RowVector3d(V.colwise().minCoeff()) : Eigen::RowVector3d::Zero();
+	Eigen::RowVector3d pext = nv ? Eigen::RowVector3d((V.colwise().maxCoeff() - pmin).array().max(1e-12).matrix()) : Eigen::RowVector3d::Ones();
+	Eigen::RowVector2d tmin = nv ? Eigen::RowVector2d(TC.colwise().minCoeff()) : Eigen::RowVector2d::Zero();
+	Eigen::RowVector2d text = nv ? Eigen::RowVector2d((TC.colwise().maxCoeff() - tmin).array().max(1e-12).matrix()) : Eigen::RowVector2d::Ones();
+	std::vector<std::pair<uint64_t, int>> order(nf);
+	igl::parallel_for(nf, [&](int i) {
+		Eigen::RowVector3d p = (V.row(F(i, 0)) + V.row(F(i, 1)) + V.row(F(i, 2))) / 3.0;
+		Eigen::RowVector2d t = (TC.row(F(i, 0)) + TC.row(F(i, 1)) + TC.row(F(i, 2))) / 3.0;
+		int q[5];
+		for (int d = 0; d < 3; d++) { q[d] = std::min(4095, int((p[d] - pmin[d]) / pext[d] * 4096)); }
+		for (int d = 0; d < 2; d++) { q[3 + d] = std::min(4095, int((t[d] - tmin[d]) / text[d] * 4096)); }
+		order[i] = { partition_internal::morton5(q), i };
+	}, 10000);
+	if (has_materials) {
+		std::sort(order.begin(), order.end(), [&](const std::pair<uint64_t, int>& a, const std::pair<uint64_t, int>& b) {
+			int ma = mesh_cpu.FM[a.second], mb = mesh_cpu.FM[b.second];
+			return ma != mb ? ma < mb : a < b;
+		});
+	}
+	else {
+		std::sort(order.begin(), order.end());
+	}
+
+	// greedy fill: a face starts a new part when its new vertices do not fit
+	std::vector<int> stamp(nv, -1);
+	std::vector<int> part_first_face;
+	int part = -1, part_vertices = 0;
+	for (int k = 0; k < nf; k++) {
+		int i = order[k].second;
+		int fresh = 0;
+		for (int j = 0; j < 3; j++) {
+			if (stamp[F(i, j)] != part) {
+				fresh++;
+				stamp[F(i, j)] = part; // counted once even if repeated in the face
+			}
+		}
+		bool new_material = has_materials && k > 0 && mesh_cpu.FM[i] != mesh_cpu.FM[order[k - 1].second];
+		if (part < 0 || part_vertices + fresh > max_vertices || new_material) {
+			part++;
+			part_first_face.push_back(k);
+			part_vertices = 0;
+			fresh = 0;
+			for (int j = 0; j < 3; j++) {
+				if (stamp[F(i, j)] != part) {
+					fresh++;
+					stamp[F(i, j)] = part;
+				}
+			}
+		}
+		part_vertices += fresh;
+	}
+	const int n_parts = part + 1;
+	part_first_face.push_back(nf);
+
+	// every part gets a contiguous vertex and index range
+	out.Parts.resize(n_parts);
+	std::vector<std::vector<int32_t>> part_vertices_list(n_parts);
+	igl::parallel_for(n_parts, [&](int p) {
+		std::vector<int32_t>& verts = part_vertices_list[p];
+		for (int k = part_first_face[p]; k < part_first_face[p + 1]; k++) {
+			for (int j = 0; j < 3; j++) { verts.push_back(F(order[k].second, j)); }
+		}
+		std::sort(verts.begin(), verts.end());
+		verts.erase(std::unique(verts.begin(), verts.end()), verts.end());
+	}, 1);
+	int vertex_base = 0;
+	for (int p = 0; p < n_parts; p++) {
+		Submesh16& s = out.Parts[p];
+		s.first_vertex = vertex_base;
+		s.vertex_count = (int)part_vertices_list[p].size();
+		s.first_index = 3 * part_first_face[p];
+		s.index_count = 3 * (part_first_face[p + 1] - part_first_face[p]);
+		s.material = has_materials && s.index_count ? mesh_cpu.FM[order[part_first_face[p]].second] : -1;
+		vertex_base += s.vertex_count;
+	}
+
+	const bool has_normals = mesh_cpu.N.rows() == nv;
+	const bool has_tangents = mesh_cpu.T.rows() == nv;
+	const bool has_colors = mesh_cpu.C.rows() == nv;
+	out.V.resize(vertex_base, 3);
+	out.TC.resize(vertex_base, TC.cols());
+	out.N.resize(has_normals ? vertex_base : 0, 3);
+	out.T.resize(has_tangents ? vertex_base : 0, 4);
+	out.C.resize(has_colors ? vertex_base : 0, mesh_cpu.C.cols());
+	out.VSource.resize(vertex_base);
+	out.Indices.resize(3 * (size_t)nf);
+	out.FSource.resize(nf);
+	igl::parallel_for(n_parts, [&](int p) {
+		const Submesh16& s = out.Parts[p];
+		const std::vector<int32_t>& verts = part_vertices_list[p];
+		for (int l = 0; l < s.vertex_count; l++) {
+			int g = verts[l];
+			out.V.row(s.first_vertex + l) = V.row(g);
+			out.TC.row(s.first_vertex + l) = TC.row(g);
+			if (has_normals) { out.N.row(s.first_vertex + l) = mesh_cpu.N.row(g); }
+			if (has_tangents) { out.T.row(s.first_vertex + l) = mesh_cpu.T.row(g); }
+			if (has_colors) { out.C.row(s.first_vertex + l) = mesh_cpu.C.row(g); }
+			out.VSource[s.first_vertex + l] = g;
+		}
+		for (int k = part_first_face[p]; k < part_first_face[p + 1]; k++) {
+			int i = order[k].second;
+			out.FSource[k] = i;
+			for (int j = 0; j < 3; j++) {
+				int l = int(std::lower_bound(verts.begin(), verts.end(), F(i, j)) - verts.begin());
+				out.Indices[3 * (size_t)k + j] = (uint16_t)l;
+			}
+		}
+	}, 1);
+
+	std::vector<char> used(nv, 0);
+	int distinct = 0;
+	for (int g : out.VSource) {
+		if (!used[g]) {
+			used[g] = 1;
+			distinct++;
+		}
+	}
+	out.Duplicated = vertex_base - distinct;
+}
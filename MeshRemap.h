@@ -0,0 +1,274 @@
+#pragma once
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <Eigen/Eigen>
+#include <igl/per_vertex_normals.h>
+#include "TaskControl.h"
+
+struct MatrixMesh
+{
+	Eigen::MatrixXd V, N, TC;
+	Eigen::MatrixXi F, FN, FTC;
+	// optional per-vertex color, indexed like V
+	Eigen::MatrixXd C;
+	// optional per-face material id
+	Eigen::VectorXi FM;
+	// optional per-face source polygon (OBJ face) of the triangulation
+	Eigen::VectorXi FP;
+	// per-vertex tangent (xyz) and bitangent sign (w), see computeTangents
+	Eigen::MatrixXd T;
+	// filled by remapMesh: original position / texcoord row of every new vertex
+	std::vector<int> VNew2VOld, VNew2TcOld;
+	// filled by remapMesh: rows of V / TC before the remap, including rows
+	// no face referenced
+	int VOldRows = 0, TcOldRows = 0;
+};
+
+// faces between two TaskControl checkpoints of the remap kernels
+const int RemapCheckEveryNth = 1 << 16;
+
+// Scratch arrays of the remap kernel, reusable across calls. They stay
+// allocated (and live through the gathers), which trades memory for speed.
+struct RemapScratch
+{
+	std::vector<int> start, slot, fill;
+};
+
+// One attribute stream for remapChannels: Width columns of src, addressed per
+// corner by idx (#F x 3). The gathered rows are moved into dst at the end,
+// so dst may be src itself. With release set (remapChannelReleasing), idx
+// is freed as soon as the new indices are written.
+template <int Width>
+struct RemapChannel
+{
+	const Eigen::MatrixXd* src;
+	const Eigen::MatrixXi* idx;
+	Eigen::MatrixXd* dst;
+	Eigen::MatrixXi* release;
+};
+
+template <int Width>
+inline RemapChannel<Width> remapChannel(const Eigen::MatrixXd& src, const Eigen::MatrixXi& idx, Eigen::MatrixXd& dst)
+{
+	return { &src, &idx, &dst, nullptr };
+}
+
+template <int Width>
+inline RemapChannel<Width> remapChannelReleasing(const Eigen::MatrixXd& src, Eigen::MatrixXi& idx, Eigen::MatrixXd& dst)
+{
+	return { &src, &idx, &dst, &idx };
+}
+
+template <int Width>
+inline void releaseChannel(const RemapChannel<Width>& channel, const Eigen::MatrixXi& f_new)
+{
+	if (channel.release && channel.release != &f_new) {
+		channel.release->resize(0, 3);
+	}
+}
+
+template <int Width>
+inline void gatherChannel(const RemapChannel<Width>& channel, const Eigen::MatrixXi& new2old, int col)
+{
+	const Eigen::MatrixXd& src = *channel.src;
+	Eigen::MatrixXd dst(new2old.rows(), Width);
+	for (int k = 0; k < dst.rows(); k++) {
+		dst.template block<1, Width>(k, 0) = src.template block<1, Width>(new2old(k, col), 0);
+	}
+	*channel.dst = std::move(dst);
+}
+
+// Generic remap: every distinct combination of per-corner indices becomes one
+// new vertex. key (normally positions) groups the corners, the other channels
+// are compared inside each group. The channel set is a compile-time list, so
+// the comparisons and gathers unroll the same way a hand-written pos+uv kernel
+// would. f_new (#F x 3) receives the new indices and may alias any idx; new2old
+// (#new x channels) holds the source row of every channel, key first.
+//
+// The corners are grouped in one flat CSR array and each channel is released
+// as soon as it has been gathered, so the peak stays close to the output size.
+// With a scratch, its arrays are used instead and keep their capacity for the
+// next call (pooled buffers for long-running processes).
+// Returns the number of new vertices, or -1 if control cancelled the remap.
+template <int KeyWidth, int... Widths>
+inline int remapChannels(RemapChannel<KeyWidth> key, Eigen::MatrixXi& f_new, Eigen::MatrixXi& new2old,
+	RemapScratch* scratch, const TaskControl* control, RemapChannel<Widths>... rest)
+{
+	constexpr int K = sizeof...(Widths);
+	using Tuple = std::array<int, K>;
+	RemapScratch local;
+	RemapScratch& s = scratch ? *scratch : local;
+	auto& start = s.start;
+	auto& slot = s.slot;
+	const Eigen::MatrixXi& f = *key.idx;
+	const int n_key = (int)key.src->rows();
+	const int nf = (int)f.rows();
+
+	// start[v] .. start[v + 1] holds the K other indices of the corners of v
+	start.assign(n_key + 1, 0);
+	for (int i = 0; i < nf; i++) {
+		for (int j = 0; j < 3; j++) {
+			start[f(i, j) + 1]++;
+		}
+	}
+	for (int i = 0; i < n_key; i++) {
+		start[i + 1] += start[i];
+	}
+	slot.resize(K * 3 * (size_t)nf);
+	{
+		auto& fill = s.fill;
+		fill.assign(start.begin(), start.end() - 1);
+		for (int i = 0; i < nf; i++) {
+			if (control && i % RemapCheckEveryNth == 0 && !control->Checkpoint(0.5f * i / nf)) {
+				return -1;
+			}
+			for (int j = 0; j < 3; j++) {
+				const Tuple t{ { (*rest.idx)(i, j)... } };
+				std::copy(t.begin(), t.end(), slot.data() + K * (size_t)fill[f(i, j)]++);
+			}
+		}
+		if (!scratch) {
+			std::vector<int>().swap(fill);
+		}
+	}
+
+	// drop duplicates inside each group, compacting towards the front
+	int count = 0;
+	for (int i = 0; i < n_key; i++) {
+		int begin = start[i];
+		int end = start[i + 1];
+		start[i] = count;
+		for (int k = begin; k < end; k++) {
+			const int* t = slot.data() + K * (size_t)k;
+			bool seen = false;
+			for (int m = start[i]; m < count && !seen; m++) {
+				seen = std::equal(t, t + K, slot.data() + K * (size_t)m);
+			}
+			if (!seen) {
+				for (int c = 0; c < K; c++) { slot[K * (size_t)count + c] = t[c]; }
+				count++;
+			}
+		}
+	}
+	start[n_key] = count;
+
+	// every corner only reads its own entries before writing f_new, so f_new
+	// may be rewritten in place
+	f_new.resize(nf, 3);
+	for (int i = 0; i < nf; i++) {
+		if (control && i % RemapCheckEveryNth == 0 && !control->Checkpoint(0.5f + 0.5f * i / nf)) {
+			return -1;
+		}
+		for (int j = 0; j < 3; j++) {
+			int v_index = f(i, j);
+			const Tuple t{ { (*rest.idx)(i, j)... } };
+			// every tuple was collected above, the search always succeeds
+			for (int k = start[v_index]; k < start[v_index + 1]; k++) {
+				if (std::equal(t.begin(), t.end(), slot.data() + K * (size_t)k)) {
+					f_new(i, j) = k;
+					break;
+				}
+			}
+		}
+	}
+
+	(void)std::initializer_list<int>{ (releaseChannel(rest, f_new), 0)... };
+
+	new2old.resize(count, 1 + K);
+	for (int i = 0; i < n_key; i++) {
+		for (int k = start[i]; k < start[i + 1]; k++) {
+			new2old(k, 0) = i;
+			for (int c = 0; c < K; c++) {
+				new2old(k, 1 + c) = slot[K * (size_t)k + c];
+			}
+		}
+	}
+	if (!scratch) {
+		std::vector<int>().swap(slot);
+		std::vector<int>().swap(start);
+	}
+
+	gatherChannel(key, new2old, 0);
+	int col = 1;
+	(void)col;
+	(void)std::initializer_list<int>{ (gatherChannel(rest, new2old, col++), 0)... };
+	return count;
+}
+
+namespace remap_internal
+{
+	// common tail of the remap entry points: maps, shared FTC / FN, normals
+	inline void finishRemap(MatrixMesh& mesh_cpu, const Eigen::MatrixXi& new2old, int v_old_rows, int tc_old_rows)
+	{
+		mesh_cpu.VOldRows = v_old_rows;
+		mesh_cpu.TcOldRows = tc_old_rows;
+		const int count = (int)new2old.rows();
+		mesh_cpu.VNew2VOld.resize(count);
+		mesh_cpu.VNew2TcOld.resize(count);
+		for (int k = 0; k < count; k++) {
+			mesh_cpu.VNew2VOld[k] = new2old(k, 0);
+			mesh_cpu.VNew2TcOld[k] = new2old(k, 1);
+		}
+		mesh_cpu.FTC = mesh_cpu.F;
+
+		//recalculate normal
+		igl::per_vertex_normals(mesh_cpu.V, mesh_cpu.F, mesh_cpu.N);
+		mesh_cpu.FN = mesh_cpu.F;
+	}
+}
+
+// F and FTC must be in range (validateMesh / sanitizeMesh), they are not
+// checked here. With a scratch, the kernel buffers are taken from it and stay
+// allocated for the next mesh (pooled buffers for long-running processes).
+// Returns false only if control cancelled the remap; the mesh is then left
+// in an unspecified state.
+inline bool remapMesh(MatrixMesh& mesh_cpu, const TaskControl* control = nullptr, RemapScratch* scratch = nullptr)
+{
+	const int v_rows = (int)mesh_cpu.V.rows(), tc_rows = (int)mesh_cpu.TC.rows();
+	Eigen::MatrixXi new2old;
+	if (remapChannels(remapChannel<3>(mesh_cpu.V, mesh_cpu.F, mesh_cpu.V), mesh_cpu.F, new2old, scratch, control,
+		remapChannel<2>(mesh_cpu.TC, mesh_cpu.FTC, mesh_cpu.TC)) < 0) {
+		return false;
+	}
+	remap_internal::finishRemap(mesh_cpu, new2old, v_rows, tc_rows);
+	return true;
+}
+
+// Same result as remapMesh, but keeps the peak close to the output size: the
+// loaded normals are dropped up front, FTC is released as soon as F has been
+// rewritten, and the kernel buffers are freed before the gathers (never
+// pooled). Returns false only if control cancelled the remap.
+inline bool remapMeshLowMemory(MatrixMesh& mesh_cpu, const TaskControl* control = nullptr)
+{
+	mesh_cpu.N.resize(0, 3);
+	mesh_cpu.FN.resize(0, 3);
+	const int v_rows = (int)mesh_cpu.V.rows(), tc_rows = (int)mesh_cpu.TC.rows();
+	Eigen::MatrixXi new2old;
+	if (remapChannels(remapChannel<3>(mesh_cpu.V, mesh_cpu.F, mesh_cpu.V), mesh_cpu.F, new2old, nullptr, control,
+		remapChannelReleasing<2>(mesh_cpu.TC, mesh_cpu.FTC, mesh_cpu.TC)) < 0) {
+		return false;
+	}
+	remap_internal::finishRemap(mesh_cpu, new2old, v_rows, tc_rows);
+	return true;
+}
+
+// remapMesh for meshes that also carry per-position colors in C; low_memory
+// as in remapMeshLowMemory. Returns false only if control cancelled the remap.
+inline bool remapMeshWithColors(MatrixMesh& mesh_cpu, const TaskControl* control = nullptr, bool low_memory = false)
+{
+	if (low_memory) {
+		mesh_cpu.N.resize(0, 3);
+		mesh_cpu.FN.resize(0, 3);
+	}
+	const int v_rows = (int)mesh_cpu.V.rows(), tc_rows = (int)mesh_cpu.TC.rows();
+	Eigen::MatrixXi new2old;
+	auto tc = low_memory ? remapChannelReleasing<2>(mesh_cpu.TC, mesh_cpu.FTC, mesh_cpu.TC) :
+		remapChannel<2>(mesh_cpu.TC, mesh_cpu.FTC, mesh_cpu.TC);
+	if (remapChannels(remapChannel<3>(mesh_cpu.V, mesh_cpu.F, mesh_cpu.V), mesh_cpu.F, new2old, nullptr, control,
+		tc, remapChannel<3>(mesh_cpu.C, mesh_cpu.F, mesh_cpu.C)) < 0) {
+		return false;
+	}
+	remap_internal::finishRemap(mesh_cpu, new2old, v_rows, tc_rows);
+	return true;
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <Eigen/Eigen>
+#include <igl/parallel_for.h>
+#include <igl/per_vertex_normals.h>
+#include "MeshRemap.h"
+
+namespace reweld_internal
+{
+	// inverse of a new -> old map as CSR: new vertices of old row o are
+	// items[start[o]] .. items[start[o + 1] - 1], ascending. There are at
+	// least n_old old rows.
+	inline void invertMap(const std::vector<int>& map, int n_old, std::vector<int>& start, std::vector<int>& items)
+	{
+		for (int o : map) { n_old = std::max(n_old, o + 1); }
+		start.assign(n_old + 1, 0);
+		for (int o : map) { start[o + 1]++; }
+		for (int o = 0; o < n_old; o++) { start[o + 1] += start[o]; }
+		items.resize(map.size());
+		std::vector<int> fill(start.begin(), start.end() - 1);
+		for (int k = 0; k < (int)map.size(); k++) { items[fill[map[k]]++] = k; }
+	}
+}
+
+// Inverse of remapMesh: go back to position-unique V with F / FTC indexing
+// separate V and TC arrays, using VNew2VOld / VNew2TcOld.
+//
+// Duplicated positions are averaged with average_positions, otherwise the
+// first copy wins (they only differ if the split mesh was edited unevenly).
+// Original rows that no face referenced come back as zeros, up to the
+// VOldRows / TcOldRows recorded by remapMesh. N is recomputed per position
+// and FN = F. Returns false if the mesh carries no maps.
+inline bool reweldMesh(MatrixMesh& mesh_cpu, bool average_positions = false)
+{
+	const int nv = (int)mesh_cpu.V.rows();
+	const int nf = (int)mesh_cpu.F.rows();
+	const auto& v_map = mesh_cpu.VNew2VOld;
+	const auto& tc_map = mesh_cpu.VNew2TcOld;
+	if ((int)v_map.size() != nv || (int)tc_map.size() != nv || mesh_cpu.TC.rows() != nv) {
+		return false;
+	}
+
+	std::vector<int> v_start, v_items, tc_start, tc_items;
+	reweld_internal::invertMap(v_map, mesh_cpu.VOldRows, v_start, v_items);
+	reweld_internal::invertMap(tc_map, mesh_cpu.TcOldRows, tc_start, tc_items);
+	const int n_v_old = (int)v_start.size() - 1;
+	const int n_tc_old = (int)tc_start.size() - 1;
+	const bool has_colors = mesh_cpu.C.rows() == nv;
+
+	Eigen::MatrixXd v_old = Eigen::MatrixXd::Zero(n_v_old, 3);
+	Eigen::MatrixXd c_old = Eigen::MatrixXd::Zero(has_colors ? n_v_old : 0, 3);
+	igl::parallel_for(n_v_old, [&](int o) {
+		int begin = v_start[o], end = v_start[o + 1];
+		if (begin == end) { return; }
+		if (!average_positions) {
+			v_old.row(o) = mesh_cpu.V.row(v_items[begin]);
+			if (has_colors) { c_old.row(o) = mesh_cpu.C.row(v_items[begin]); }
+			return;
+		}
+		for (int k = begin; k < end; k++) {
+			v_old.row(o) += mesh_cpu.V.row(v_items[k]);
+			if (has_colors) { c_old.row(o) += mesh_cpu.C.row(v_items[k]); }
+		}
+		v_old.row(o) /= double(end - begin);
+		if (has_colors) { c_old.row(o) /= double(end - begin); }
+	}, 10000);
+
+	Eigen::MatrixXd tc_old = Eigen::MatrixXd::Zero(n_tc_old, 2);
+	igl::parallel_for(n_tc_old, [&](int o) {
+		if (tc_start[o] < tc_start[o + 1]) {
+			tc_old.row(o) = mesh_cpu.TC.row(tc_items[tc_start[o]]);
+		}
+	}, 10000);
+
+	Eigen::MatrixXi f_old(nf, 3), ftc_old(nf, 3);
+	igl::parallel_for(nf, [&](int i) {
+		for (int j = 0; j < 3; j++) {
+			int k = mesh_cpu.F(i, j);
+			f_old(i, j) = v_map[k];
+			ftc_old(i, j) = tc_map[k];
+		}
+	}, 10000);
+
+	mesh_cpu.V = std::move(v_old);
+	mesh_cpu.TC = std::move(tc_old);
+	mesh_cpu.F = std::move(f_old);
+	mesh_cpu.FTC = std::move(ftc_old);
+	if (has_colors) {
+		mesh_cpu.C = std::move(c_old);
+	}
+	mesh_cpu.T.resize(0, 4);
+	mesh_cpu.VNew2VOld.clear();
+	mesh_cpu.VNew2TcOld.clear();
+	mesh_cpu.VOldRows = 0;
+	mesh_cpu.TcOldRows = 0;
+
+	igl::per_vertex_normals(mesh_cpu.V, mesh_cpu.F, mesh_cpu.N);
+	mesh_cpu.FN = mesh_cpu.F;
+	return true;
+}
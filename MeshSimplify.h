@@ -0,0 +1,355 @@
+#pragma once
+#include <vector>
+#include <queue>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <Eigen/Eigen>
+#include <igl/parallel_for.h>
+#include "MeshRemap.h"
+
+namespace lod_internal
+{
+	struct Collapse
+	{
+		double cost;
+		int u, v;
+		int stamp_u, stamp_v;
+		bool operator>(const Collapse& o) const { return cost > o.cost; }
+	};
+
+	// Half-edge collapse QEM on one group of faces. Vertices flagged in locked
+	// are never removed, so groups that only share locked vertices can be
+	// simplified independently. faces holds global vertex ids and is replaced
+	// by the surviving faces.
+	inline void simplifyFaces(const MatrixMesh& mesh, std::vector<Eigen::Vector3i>& faces,
+		const std::vector<char>& locked, int target, double uv_weight, double normal_weight)
+	{
+		if ((int)faces.size() <= target) {
+			return;
+		}
+		const auto& V = mesh.V;
+		const auto& TC = mesh.TC;
+		const auto& N = mesh.N;
+
+		// local vertex numbering
+		std::vector<int> verts;
+		verts.reserve(faces.size() * 3);
+		for (auto& f : faces) {
+			for (int j = 0; j < 3; j++) { verts.push_back(f[j]); }
+		}
+		std::sort(verts.begin(), verts.end());
+		verts.erase(std::unique(verts.begin(), verts.end()), verts.end());
+		const int nl = (int)verts.size();
+		const int nf = (int)faces.size();
+
+		std::vector<Eigen::Vector3i> lf(nf);
+		std::vector<std::vector<int>> vf(nl);
+		for (int i = 0; i < nf; i++) {
+			for (int j = 0; j < 3; j++) {
+				lf[i][j] = int(std::lower_bound(verts.begin(), verts.end(), faces[i][j]) - verts.begin());
+				vf[lf[i][j]].push_back(i);
+			}
+		}
+
+		std::vector<Eigen::Matrix4d> Q(nl, Eigen::Matrix4d::Zero());
+		for (int i = 0; i < nf; i++) {
+			Eigen::RowVector3d p0 = V.row(faces[i][0]);
+			Eigen::RowVector3d e1 = V.row(faces[i][1]) - p0;
+			Eigen::RowVector3d e2 = V.row(faces[i][2]) - p0;
+			Eigen::Vector3d n = e1.cross(e2).transpose();
+			double area2 = n.norm();
+			if (area2 == 0) {
+				continue;
+			}
+			n /= area2;
+			Eigen::Vector4d plane(n.x(), n.y(), n.z(), -n.dot(p0.transpose()));
+			Eigen::Matrix4d K = (0.5 * area2) * plane * plane.transpose();
+			for (int j = 0; j < 3; j++) { Q[lf[i][j]] += K; }
+		}
+
+		std::vector<char> face_alive(nf, 1), vert_alive(nl, 1);
+		std::vector<int> stamp(nl, 0);
+		int alive = nf;
+
+		auto cost = [&](int u, int v) {
+			Eigen::Vector4d p(V(verts[v], 0), V(verts[v], 1), V(verts[v], 2), 1.0);
+			double c = p.dot((Q[u] + Q[v]) * p);
+			c += uv_weight * (TC.row(verts[u]) - TC.row(verts[v])).squaredNorm();
+			if (N.rows() == V.rows()) {
+				c += normal_weight * (1.0 - N.row(verts[u]).dot(N.row(verts[v])));
+			}
+			return std::max(c, 0.0);
+		};
+
+		std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> heap;
+		auto push = [&](int u, int v) {
+			if (!locked[verts[u]]) {
+				heap.push({ cost(u, v), u, v, stamp[u], stamp[v] });
+			}
+		};
+		for (int i = 0; i < nf; i++) {
+			for (int j = 0; j < 3; j++) {
+				push(lf[i][j], lf[i][(j + 1) % 3]);
+				push(lf[i][(j + 1) % 3], lf[i][j]);
+			}
+		}
+
+		auto neighbors = [&](int u, std::vector<int>& out) {
+			out.clear();
+			for (int f : vf[u]) {
+				if (!face_alive[f]) { continue; }
+				for (int j = 0; j < 3; j++) {
+					if (lf[f][j] != u) { out.push_back(lf[f][j]); }
+				}
+			}
+			std::sort(out.begin(), out.end());
+			out.erase(std::unique(out.begin(), out.end()), out.end());
+		};
+
+		std::vector<int> nu, nv, common;
+		while (alive > target && !heap.empty()) {
+			Collapse c = heap.top();
+			heap.pop();
+			int u = c.u, v = c.v;
+			if (!vert_alive[u] || !vert_alive[v] || c.stamp_u != stamp[u] || c.stamp_v != stamp[v]) {
+				continue;
+			}
+
+			// link condition: u and v may only share the vertices opposite the edge
+			neighbors(u, nu);
+			if (!std::binary_search(nu.begin(), nu.end(), v)) {
+				continue;
+			}
+			neighbors(v, nv);
+			common.clear();
+			std::set_intersection(nu.begin(), nu.end(), nv.begin(), nv.end(), std::back_inserter(common));
+			int shared_faces = 0;
+			for (int f : vf[u]) {
+				if (face_alive[f] && (lf[f][0] == v || lf[f][1] == v || lf[f][2] == v)) { shared_faces++; }
+			}
+			if ((int)common.size() != shared_faces) {
+				continue;
+			}
+
+			// reject collapses that flip a face
+			bool flips = false;
+			for (int f : vf[u]) {
+				if (!face_alive[f] || lf[f][0] == v || lf[f][1] == v || lf[f][2] == v) { continue; }
+				Eigen::RowVector3d p[3], q[3];
+				for (int j = 0; j < 3; j++) {
+					p[j] = V.row(verts[lf[f][j]]);
+					q[j] = lf[f][j] == u ? Eigen::RowVector3d(V.row(verts[v])) : p[j];
+				}
+				Eigen::RowVector3d n0 = (p[1] - p[0]).cross(p[2] - p[0]);
+				Eigen::RowVector3d n1 = (q[1] - q[0]).cross(q[2] - q[0]);
+				if (n0.dot(n1) <= 0) {
+					flips = true;
+					break;
+				}
+			}
+			if (flips) {
+				continue;
+			}
+
+			for (int f : vf[u]) {
+				if (!face_alive[f]) { continue; }
+				if (lf[f][0] == v || lf[f][1] == v || lf[f][2] == v) {
+					face_alive[f] = 0;
+					alive--;
+					continue;
+				}
+				for (int j = 0; j < 3; j++) {
+					if (lf[f][j] == u) { lf[f][j] = v; }
+				}
+				vf[v].push_back(f);
+			}
+			std::vector<int>().swap(vf[u]);
+			vert_alive[u] = 0;
+			Q[v] += Q[u];
+			stamp[v]++;
+
+			neighbors(v, nv);
+			for (int w : nv) {
+				push(w, v);
+				push(v, w);
+			}
+		}
+
+		faces.clear();
+		for (int i = 0; i < nf; i++) {
+			if (face_alive[i]) {
+				faces.emplace_back(verts[lf[i][0]], verts[lf[i][1]], verts[lf[i][2]]);
+			}
+		}
+	}
+}
+
+// Simplify a remapped mesh to about target_faces triangles.
+//
+// UV seams stay intact: every vertex whose position was duplicated by
+// remapMesh (VNew2VOld) and every vertex on an open border is locked.
+// Faces are binned by centroid into a grid of roughly cell_faces triangles
+// per cell and split by FM; these groups are simplified in parallel with the
+// vertices they share locked, so material borders keep their shape and every
+// surviving face keeps its FM. C and T follow the surviving vertices.
+// grid_offset shifts the grid (in cells) so a chain of LODs does not keep the
+// same cell borders at every level.
+inline void simplifyMesh(const MatrixMesh& mesh_cpu, int target_faces, MatrixMesh& out,
+	double uv_weight = 1.0, double normal_weight = 0.01, int cell_faces = 20000, double grid_offset = 0.0)
+{
+	const auto& V = mesh_cpu.V;
+	const auto& F = mesh_cpu.F;
+	const int nv = (int)V.rows();
+	const int nf = (int)F.rows();
+
+	std::vector<char> locked(nv, 0);
+
+	// seam vertices: positions that remapMesh split into several vertices
+	if ((int)mesh_cpu.VNew2VOld.size() == nv) {
+		int n_old = 0;
+		for (int i = 0; i < nv; i++) { n_old = std::max(n_old, mesh_cpu.VNew2VOld[i] + 1); }
+		std::vector<int> old_count(n_old, 0);
+		for (int i = 0; i < nv; i++) { old_count[mesh_cpu.VNew2VOld[i]]++; }
+		for (int i = 0; i < nv; i++) {
+			if (old_count[mesh_cpu.VNew2VOld[i]] > 1) { locked[i] = 1; }
+		}
+	}
+
+	// open borders (includes the seams when the maps are not available)
+	{
+		std::vector<uint64_t> edges(3 * (size_t)nf);
+		for (int i = 0; i < nf; i++) {
+			for (int j = 0; j < 3; j++) {
+				uint64_t a = F(i, j), b = F(i, (j + 1) % 3);
+				edges[3 * i + j] = a < b ? (a << 32 | b) : (b << 32 | a);
+			}
+		}
+		std::sort(edges.begin(), edges.end());
+		for (size_t k = 0; k < edges.size();) {
+			size_t e = k + 1;
+			while (e < edges.size() && edges[e] == edges[k]) { e++; }
+			if (e - k == 1) {
+				locked[edges[k] >> 32] = 1;
+				locked[edges[k] & 0xffffffffu] = 1;
+			}
+			k = e;
+		}
+	}
+
+	// spatial partition
+	int grid = std::max(1, (int)std::round(std::cbrt(double(nf) / std::max(1, cell_faces))));
+	Eigen::RowVector3d bmin = V.colwise().minCoeff();
+	Eigen::RowVector3d extent = (V.colwise().maxCoeff() - bmin).array().max(1e-12).matrix();
+	std::vector<int> face_cell(nf);
+	for (int i = 0; i < nf; i++) {
+		Eigen::RowVector3d c = (V.row(F(i, 0)) + V.row(F(i, 1)) + V.row(F(i, 2))) / 3.0;
+		int cell = 0;
+		for (int d = 0; d < 3; d++) {
+			int x = (int)std::floor((c[d] - bmin[d]) / extent[d] * grid + grid_offset);
+			cell = cell * (grid + 1) + std::max(0, std::min(grid, x));
+		}
+		face_cell[i] = cell;
+	}
+	const bool has_materials = mesh_cpu.FM.size() == nf;
+	std::vector<std::pair<uint64_t, int>> order(nf);
+	for (int i = 0; i < nf; i++) {
+		uint32_t material = has_materials ? (uint32_t)mesh_cpu.FM[i] : 0;
+		order[i] = { (uint64_t)face_cell[i] << 32 | material, i };
+	}
+	std::sort(order.begin(), order.end());
+	std::vector<std::vector<Eigen::Vector3i>> cells;
+	std::vector<int> cell_material;
+	{
+		std::vector<int> owner(nv, -1);
+		for (int k = 0; k < nf; k++) {
+			int i = order[k].second;
+			if (k == 0 || order[k].first != order[k - 1].first) {
+				cells.emplace_back();
+				cell_material.push_back(has_materials ? mesh_cpu.FM[i] : -1);
+			}
+			const int group = (int)cells.size() - 1;
+			cells.back().emplace_back(F.row(i).transpose());
+			for (int j = 0; j < 3; j++) {
+				int& o = owner[F(i, j)];
+				if (o == -1) { o = group; }
+				else if (o != group) { locked[F(i, j)] = 1; }
+			}
+		}
+	}
+	const int n_cells = (int)cells.size();
+
+	const double ratio = nf > 0 ? double(target_faces) / nf : 1.0;
+	const double diag = extent.norm();
+	// uv error is measured in the same squared units as the quadrics
+	const double uv_scale = uv_weight * diag * diag;
+	igl::parallel_for(n_cells, [&](int c) {
+		if (cells[c].empty()) { return; }
+		int target = (int)std::round(cells[c].size() * ratio);
+		lod_internal::simplifyFaces(mesh_cpu, cells[c], locked, target, uv_scale, normal_weight * diag * diag);
+	}, 1);
+
+	// compact the surviving vertices
+	std::vector<int> new_index(nv, -1);
+	int n_faces = 0, count = 0;
+	for (auto& cell : cells) {
+		n_faces += (int)cell.size();
+		for (auto& f : cell) {
+			for (int j = 0; j < 3; j++) {
+				if (new_index[f[j]] < 0) { new_index[f[j]] = count++; }
+			}
+		}
+	}
+	std::vector<int> new2old(count);
+	for (int i = 0; i < nv; i++) {
+		if (new_index[i] >= 0) { new2old[new_index[i]] = i; }
+	}
+
+	out.F.resize(n_faces, 3);
+	out.FM.resize(has_materials ? n_faces : 0);
+	int k = 0;
+	for (int c = 0; c < n_cells; c++) {
+		for (auto& f : cells[c]) {
+			for (int j = 0; j < 3; j++) { out.F(k, j) = new_index[f[j]]; }
+			if (has_materials) { out.FM[k] = cell_material[c]; }
+			k++;
+		}
+	}
+	out.V.resize(count, 3);
+	out.TC.resize(count, mesh_cpu.TC.cols());
+	out.N.resize(mesh_cpu.N.rows() == nv ? count : 0, 3);
+	out.T.resize(mesh_cpu.T.rows() == nv ? count : 0, 4);
+	out.C.resize(mesh_cpu.C.rows() == nv ? count : 0, mesh_cpu.C.cols());
+	out.VNew2VOld.resize((int)mesh_cpu.VNew2VOld.size() == nv ? count : 0);
+	out.VNew2TcOld.resize((int)mesh_cpu.VNew2TcOld.size() == nv ? count : 0);
+	igl::parallel_for(count, [&](int i) {
+		int o = new2old[i];
+		out.V.row(i) = V.row(o);
+		out.TC.row(i) = mesh_cpu.TC.row(o);
+		if (out.N.rows()) { out.N.row(i) = mesh_cpu.N.row(o); }
+		if (out.T.rows()) { out.T.row(i) = mesh_cpu.T.row(o); }
+		if (out.C.rows()) { out.C.row(i) = mesh_cpu.C.row(o); }
+		if (!out.VNew2VOld.empty()) { out.VNew2VOld[i] = mesh_cpu.VNew2VOld[o]; }
+		if (!out.VNew2TcOld.empty()) { out.VNew2TcOld[i] = mesh_cpu.VNew2TcOld[o]; }
+	}, 10000);
+	out.VOldRows = mesh_cpu.VOldRows;
+	out.TcOldRows = mesh_cpu.TcOldRows;
+	out.FTC = out.F;
+	out.FN = out.F;
+}
+
+// Build a chain of LODs, ratios are relative to the triangle count of
+// mesh_cpu (e.g. {0.5, 0.25, 0.125}). Each level starts from the previous one.
+inline void buildLodChain(const MatrixMesh& mesh_cpu, const std::vector<double>& ratios,
+	std::vector<MatrixMesh>& lods, double uv_weight = 1.0, double normal_weight = 0.01)
+{
+	lods.clear();
+	lods.reserve(ratios.size());
+	const MatrixMesh* prev = &mesh_cpu;
+	for (size_t i = 0; i < ratios.size(); i++) {
+		int target = (int)std::round(mesh_cpu.F.rows() * ratios[i]);
+		lods.emplace_back();
+		simplifyMesh(*prev, target, lods.back(), uv_weight, normal_weight, 20000, 0.5 * (i % 2));
+		prev = &lods.back();
+	}
+}
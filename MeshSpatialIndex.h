@@ -0,0 +1,513 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <Eigen/Eigen>
+#include <igl/parallel_for.h>
+#include "MeshRemap.h"
+
+// Uniform grid over the triangles of a remapped mesh, used in UV space
+// (Dim 2, over TC). Cells are about the size of an average triangle; a
+// triangle is listed in every cell its bounding box touches.
+template <int Dim>
+struct TriangleGrid
+{
+	typedef Eigen::Matrix<float, Dim, 1> Point;
+	typedef Eigen::Matrix<int, Dim, 1> Cell;
+	Point origin, cell;
+	Cell res;
+	// triangles of cell k: items[start[k]] .. items[start[k + 1] - 1], ascending
+	std::vector<int32_t> start, items;
+	// corners of triangle i at 3 * i .. 3 * i + 2
+	std::vector<Point> corners;
+};
+typedef TriangleGrid<2> UVIndex;
+
+// Bounding volume hierarchy over the triangles of a remapped mesh in 3D.
+// Triangles are sorted along a Morton curve and cut into leaves of LeafSize;
+// the inner nodes split at the highest differing Morton bit (Karras, Maximizing
+// Parallelism in the Construction of BVHs, Octrees, and k-d Trees, 2012).
+struct SurfaceIndex
+{
+	static const int LeafSize = 4;
+	// children of inner node n at child[2 * n] and child[2 * n + 1], a negative
+	// value c is leaf ~c. Inner node 0 is the root unless there is one leaf.
+	std::vector<int32_t> child;
+	// boxes of the inner nodes (n_leaves - 1 of them), then of the leaves
+	std::vector<Eigen::AlignedBox3f> boxes;
+	int n_leaves = 0;
+	// triangles in leaf order; corners of order[s] at 3 * s .. 3 * s + 2
+	std::vector<int32_t> order;
+	std::vector<Eigen::Vector3f> corners;
+};
+
+// Caller-allocated results of a batched query, one entry per point
+struct SurfaceQueryResult
+{
+	// triangle found, -1 if the mesh has none
+	int32_t* triangle;
+	// barycentric weights of F(triangle, 1) and F(triangle, 2)
+	float* bary1;
+	float* bary2;
+	// distance to the triangle, 0 inside a UV chart (optional)
+	float* distance;
+};
+
+namespace spatial_internal
+{
+	template <int Dim>
+	inline int cellIndex(const TriangleGrid<Dim>& grid, const typename TriangleGrid<Dim>::Cell& c)
+	{
+		int k = 0;
+		for (int d = Dim - 1; d >= 0; d--) { k = k * grid.res[d] + c[d]; }
+		return k;
+	}
+
+	// cell of p, clamped to the grid
+	template <int Dim>
+	inline typename TriangleGrid<Dim>::Cell cellOf(const TriangleGrid<Dim>& grid, const typename TriangleGrid<Dim>::Point& p)
+	{
+		typename TriangleGrid<Dim>::Cell c;
+		for (int d = 0; d < Dim; d++) {
+			float x = std::floor((p[d] - grid.origin[d]) / grid.cell[d]);
+			c[d] = x > 0 ? (int)std::min(float(grid.res[d] - 1), x) : 0;
+		}
+		return c;
+	}
+
+	// fn(k) for every cell k of the box lo .. hi
+	template <int Dim, typename Fn>
+	inline void forBox(const TriangleGrid<Dim>& grid, const typename TriangleGrid<Dim>::Cell& lo,
+		const typename TriangleGrid<Dim>::Cell& hi, Fn fn)
+	{
+		typename TriangleGrid<Dim>::Cell c = lo;
+		while (true) {
+			fn(cellIndex(grid, c));
+			int d = 0;
+			while (d < Dim && c[d] == hi[d]) { c[d] = lo[d]; d++; }
+			if (d == Dim) { return; }
+			c[d]++;
+		}
+	}
+
+	// fn(k, c) for every cell k (coordinates c) at Chebyshev distance r from center
+	template <int Dim, typename Fn>
+	inline void forShell(const TriangleGrid<Dim>& grid, const typename TriangleGrid<Dim>::Cell& center, int r, Fn fn)
+	{
+		typename TriangleGrid<Dim>::Cell lo, hi, c;
+		for (int d = 0; d < Dim; d++) {
+			lo[d] = std::max(0, center[d] - r);
+			hi[d] = std::min(grid.res[d] - 1, center[d] + r);
+		}
+		c = lo;
+		while (true) {
+			bool on_shell = Dim == 1;
+			for (int d = 1; d < Dim; d++) { on_shell = on_shell || std::abs(c[d] - center[d]) == r; }
+			if (on_shell) {
+				for (c[0] = lo[0]; c[0] <= hi[0]; c[0]++) { fn(cellIndex(grid, c), c); }
+			}
+			else {
+				// only the two ends of the row are on the shell
+				if (center[0] - r >= 0) {
+					c[0] = center[0] - r;
+					fn(cellIndex(grid, c), c);
+				}
+				if (center[0] + r < grid.res[0]) {
+					c[0] = center[0] + r;
+					fn(cellIndex(grid, c), c);
+				}
+			}
+			int d = 1;
+			while (d < Dim && c[d] == hi[d]) { c[d] = lo[d]; d++; }
+			if (d >= Dim) { return; }
+			c[d]++;
+		}
+	}
+
+	// Closest point of triangle abc to p, as the barycentric weights v, w of
+	// b and c (Ericson, Real-Time Collision Detection 5.1.5)
+	template <typename P>
+	inline void closestOnTriangle(const P& p, const P& a, const P& b, const P& c, float& v, float& w)
+	{
+		P ab = b - a, ac = c - a, ap = p - a;
+		float d1 = ab.dot(ap), d2 = ac.dot(ap);
+		v = w = 0;
+		if (d1 <= 0 && d2 <= 0) { return; }
+		P bp = p - b;
+		float d3 = ab.dot(bp), d4 = ac.dot(bp);
+		if (d3 >= 0 && d4 <= d3) { v = 1; return; }
+		float vc = d1 * d4 - d3 * d2;
+		if (vc <= 0 && d1 >= 0 && d3 <= 0) { v = d1 / (d1 - d3); return; }
+		P cp = p - c;
+		float d5 = ab.dot(cp), d6 = ac.dot(cp);
+		if (d6 >= 0 && d5 <= d6) { w = 1; return; }
+		float vb = d5 * d2 - d1 * d6;
+		if (vb <= 0 && d2 >= 0 && d6 <= 0) { w = d2 / (d2 - d6); return; }
+		float va = d3 * d6 - d5 * d4;
+		if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0) {
+			w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+			v = 1 - w;
+			return;
+		}
+		float sum = va + vb + vc;
+		if (sum > 0) {
+			v = vb / sum;
+			w = vc / sum;
+		}
+	}
+
+	// First triangle (lowest index) whose UV triangle contains p
+	inline int coveringTriangle(const UVIndex& index, const UVIndex::Point& p, float& v, float& w)
+	{
+		const float eps = 1e-6f;
+		int k = cellIndex(index, cellOf(index, p));
+		for (int s = index.start[k]; s < index.start[k + 1]; s++) {
+			int i = index.items[s];
+			const UVIndex::Point& a = index.corners[3 * i];
+			UVIndex::Point e1 = index.corners[3 * i + 1] - a, e2 = index.corners[3 * i + 2] - a, ap = p - a;
+			float det = e1[0] * e2[1] - e1[1] * e2[0];
+			if (det == 0) { continue; }
+			float bv = (ap[0] * e2[1] - ap[1] * e2[0]) / det;
+			float bw = (e1[0] * ap[1] - e1[1] * ap[0]) / det;
+			if (bv >= -eps && bw >= -eps && bv + bw <= 1 + eps) {
+				v = bv;
+				w = bw;
+				return i;
+			}
+		}
+		return -1;
+	}
+
+	// Nearest triangle to p, searching shells of cells outwards until no
+	// unvisited cell can hold anything closer. Cells farther than the best
+	// hit so far are skipped. Ties go to the lower index.
+	template <int Dim>
+	inline int nearestTriangle(const TriangleGrid<Dim>& grid, const typename TriangleGrid<Dim>::Point& p, float& v, float& w, float& dist)
+	{
+		typedef typename TriangleGrid<Dim>::Point Point;
+		typedef typename TriangleGrid<Dim>::Cell Cell;
+		Cell center = cellOf(grid, p);
+		int max_r = 0;
+		for (int d = 0; d < Dim; d++) { max_r = std::max(max_r, std::max(center[d], grid.res[d] - 1 - center[d])); }
+		// how far p lies outside the grid along each axis
+		Point grid_hi = grid.origin + grid.res.template cast<float>().cwiseProduct(grid.cell);
+		Point outside = (grid.origin - p).cwiseMax(p - grid_hi).cwiseMax(0.0f);
+		const float outside2 = outside.squaredNorm();
+
+		int best = -1;
+		float best_d2 = std::numeric_limits<float>::infinity();
+		for (int r = 0; r <= max_r; r++) {
+			forShell(grid, center, r, [&](int k, const Cell& at) {
+				if (grid.start[k] == grid.start[k + 1]) { return; }
+				Point lo = grid.origin + at.template cast<float>().cwiseProduct(grid.cell);
+				Point gap = (lo - p).cwiseMax(p - lo - grid.cell).cwiseMax(0.0f);
+				if (gap.squaredNorm() > best_d2) { return; }
+				for (int s = grid.start[k]; s < grid.start[k + 1]; s++) {
+					int i = grid.items[s];
+					const Point& a = grid.corners[3 * i];
+					const Point& b = grid.corners[3 * i + 1];
+					const Point& c = grid.corners[3 * i + 2];
+					float tv, tw;
+					closestOnTriangle(p, a, b, c, tv, tw);
+					float d2 = ((1 - tv - tw) * a + tv * b + tw * c - p).squaredNorm();
+					if (d2 < best_d2 || (d2 == best_d2 && i < best)) {
+						best = i;
+						best_d2 = d2;
+						v = tv;
+						w = tw;
+					}
+				}
+			});
+			// squared distance from p to the cells beyond shell r: the slab past
+			// the shell on one side, within the grid along the other axes
+			float reach2 = std::numeric_limits<float>::infinity();
+			for (int d = 0; d < Dim; d++) {
+				float across = outside2 - outside[d] * outside[d];
+				if (center[d] - r > 0) {
+					float g = p[d] - (grid.origin[d] + (center[d] - r) * grid.cell[d]);
+					reach2 = std::min(reach2, across + g * g);
+				}
+				if (center[d] + r < grid.res[d] - 1) {
+					float g = grid.origin[d] + (center[d] + r + 1) * grid.cell[d] - p[d];
+					reach2 = std::min(reach2, across + g * g);
+				}
+			}
+			if (best >= 0 && best_d2 <= reach2) { break; }
+		}
+		dist = std::sqrt(best_d2);
+		return best;
+	}
+
+	// spread the low 10 bits of x to every third bit
+	inline uint32_t spreadBits3(uint32_t x)
+	{
+		x &= 0x3ff;
+		x = (x | (x << 16)) & 0x030000ff;
+		x = (x | (x << 8)) & 0x0300f00f;
+		x = (x | (x << 4)) & 0x030c30c3;
+		x = (x | (x << 2)) & 0x09249249;
+		return x;
+	}
+}
+
+// Build the grid over the first Dim columns of P and F in parallel
+template <int Dim>
+inline void buildTriangleGrid(const Eigen::MatrixXd& P, const Eigen::MatrixXi& F, TriangleGrid<Dim>& grid)
+{
+	typedef typename TriangleGrid<Dim>::Point Point;
+	typedef typename TriangleGrid<Dim>::Cell Cell;
+	const int nf = (int)F.rows();
+
+	grid.corners.resize(3 * (size_t)nf);
+	igl::parallel_for(nf, [&](int i) {
+		for (int j = 0; j < 3; j++) {
+			for (int d = 0; d < Dim; d++) { grid.corners[3 * i + j][d] = (float)P(F(i, j), d); }
+		}
+	}, 10000);
+
+	grid.res = Cell::Ones();
+	grid.origin = Point::Zero();
+	grid.cell = Point::Ones();
+	if (nf == 0 || P.rows() == 0) {
+		grid.start.assign(2, 0);
+		grid.items.clear();
+		return;
+	}
+
+	// cells about the size of an average triangle, so charts with gaps
+	// between them do not crowd a few cells, but no more than 4 cells per
+	// triangle. Flat directions get a single layer.
+	std::vector<float> area(nf);
+	igl::parallel_for(nf, [&](int i) {
+		Point e1 = grid.corners[3 * i + 1] - grid.corners[3 * i], e2 = grid.corners[3 * i + 2] - grid.corners[3 * i];
+		area[i] = 0.5f * std::sqrt(std::max(0.0f, e1.squaredNorm() * e2.squaredNorm() - e1.dot(e2) * e1.dot(e2)));
+	}, 10000);
+	double mean_area = 0;
+	for (float a : area) { mean_area += a; }
+	mean_area /= nf;
+
+	Eigen::RowVectorXd lo = P.leftCols(Dim).colwise().minCoeff();
+	Eigen::RowVectorXd hi = P.leftCols(Dim).colwise().maxCoeff();
+	Point ext;
+	for (int d = 0; d < Dim; d++) { ext[d] = float(hi[d] - lo[d]); }
+	const float min_ext = std::max(ext.maxCoeff() * 1e-3f, 1e-12f);
+	ext = ext.cwiseMax(min_ext);
+	float cell = std::max((float)std::sqrt(mean_area), std::pow(ext.prod() / (4.0f * nf), 1.0f / Dim));
+	for (int d = 0; d < Dim; d++) {
+		grid.res[d] = std::max(1, std::min(1 << (24 / Dim), (int)std::ceil(ext[d] / cell)));
+		grid.origin[d] = float(lo[d]);
+		grid.cell[d] = ext[d] / grid.res[d];
+	}
+	const int n_cells = grid.res.prod();
+
+	auto triangleBox = [&](int i, Cell& box_lo, Cell& box_hi) {
+		Point a = grid.corners[3 * i], b = grid.corners[3 * i];
+		for (int j = 1; j < 3; j++) {
+			a = a.cwiseMin(grid.corners[3 * i + j]);
+			b = b.cwiseMax(grid.corners[3 * i + j]);
+		}
+		box_lo = spatial_internal::cellOf(grid, a);
+		box_hi = spatial_internal::cellOf(grid, b);
+	};
+
+	// cell -> triangles, counted and filled like MeshAdjacency::VF
+	std::unique_ptr<std::atomic<int32_t>[]> cursor(new std::atomic<int32_t>[n_cells + 1]);
+	igl::parallel_for(n_cells + 1, [&](int k) { cursor[k].store(0, std::memory_order_relaxed); }, 100000);
+	igl::parallel_for(nf, [&](int i) {
+		Cell box_lo, box_hi;
+		triangleBox(i, box_lo, box_hi);
+		spatial_internal::forBox(grid, box_lo, box_hi, [&](int k) { cursor[k + 1].fetch_add(1, std::memory_order_relaxed); });
+	}, 10000);
+	grid.start.resize(n_cells + 1);
+	grid.start[0] = 0;
+	for (int k = 0; k < n_cells; k++) {
+		grid.start[k + 1] = grid.start[k] + cursor[k + 1].load(std::memory_order_relaxed);
+	}
+	igl::parallel_for(n_cells, [&](int k) { cursor[k].store(grid.start[k], std::memory_order_relaxed); }, 100000);
+	grid.items.resize(grid.start[n_cells]);
+	igl::parallel_for(nf, [&](int i) {
+		Cell box_lo, box_hi;
+		triangleBox(i, box_lo, box_hi);
+		spatial_internal::forBox(grid, box_lo, box_hi, [&](int k) {
+			grid.items[cursor[k].fetch_add(1, std::memory_order_relaxed)] = i;
+		});
+	}, 10000);
+	igl::parallel_for(n_cells, [&](int k) {
+		std::sort(grid.items.begin() + grid.start[k], grid.items.begin() + grid.start[k + 1]);
+	}, 10000);
+}
+
+inline void buildUVIndex(const MatrixMesh& mesh_cpu, UVIndex& index)
+{
+	buildTriangleGrid(mesh_cpu.TC, mesh_cpu.F, index);
+}
+
+// Build the BVH over V and F in parallel
+inline void buildSurfaceIndex(const MatrixMesh& mesh_cpu, SurfaceIndex& index)
+{
+	const auto& V = mesh_cpu.V;
+	const auto& F = mesh_cpu.F;
+	const int nf = (int)F.rows();
+
+	// Morton order of the centroids
+	Eigen::RowVector3d lo = nf ? Eigen::RowVector3d(V.colwise().minCoeff()) : Eigen::RowVector3d::Zero();
+	Eigen::RowVector3d ext = nf ? Eigen::RowVector3d((V.colwise().maxCoeff() - lo).array().max(1e-12).matrix()) : Eigen::RowVector3d::Ones();
+	std::vector<std::pair<uint32_t, int32_t>> keys(nf);
+	igl::parallel_for(nf, [&](int i) {
+		Eigen::RowVector3d c = (V.row(F(i, 0)) + V.row(F(i, 1)) + V.row(F(i, 2))) / 3.0;
+		uint32_t key = 0;
+		for (int d = 0; d < 3; d++) {
+			uint32_t q = (uint32_t)std::min(1023.0, std::max(0.0, (c[d] - lo[d]) / ext[d] * 1024));
+			key |= spatial_internal::spreadBits3(q) << d;
+		}
+		keys[i] = { key, i };
+	}, 10000);
+	std::sort(keys.begin(), keys.end());
+
+	index.order.resize(nf);
+	index.corners.resize(3 * (size_t)nf);
+	igl::parallel_for(nf, [&](int s) {
+		int i = keys[s].second;
+		index.order[s] = i;
+		for (int j = 0; j < 3; j++) { index.corners[3 * s + j] = V.row(F(i, j)).transpose().cast<float>(); }
+	}, 10000);
+
+	const int n_leaves = (nf + SurfaceIndex::LeafSize - 1) / SurfaceIndex::LeafSize;
+	const int n_inner = std::max(0, n_leaves - 1);
+	index.n_leaves = n_leaves;
+	index.child.resize(2 * (size_t)n_inner);
+	index.boxes.assign((size_t)n_inner + n_leaves, Eigen::AlignedBox3f());
+
+	// leaf keys made unique by the leaf index; delta is the common prefix
+	// length of two leaf keys, -1 outside the leaf range
+	auto leafKey = [&](int l) { return (uint64_t(keys[l * SurfaceIndex::LeafSize].first) << 32) | uint32_t(l); };
+	auto delta = [&](int a, int b) -> int {
+		if (b < 0 || b >= n_leaves) { return -1; }
+		uint64_t x = leafKey(a) ^ leafKey(b);
+		int n = 0;
+		while (n < 64 && !(x & (uint64_t(1) << (63 - n)))) { n++; }
+		return n;
+	};
+	// parent of every node, inner nodes first, then leaves
+	std::vector<int32_t> parent((size_t)n_inner + n_leaves, -1);
+	igl::parallel_for(n_inner, [&](int i) {
+		// direction and far end of the range of node i
+		int d = delta(i, i + 1) > delta(i, i - 1) ? 1 : -1;
+		int delta_min = delta(i, i - d);
+		int l_max = 2;
+		while (delta(i, i + l_max * d) > delta_min) { l_max *= 2; }
+		int l = 0;
+		for (int t = l_max / 2; t >= 1; t /= 2) {
+			if (delta(i, i + (l + t) * d) > delta_min) { l += t; }
+		}
+		int j = i + l * d;
+		// split where the common prefix gets shorter
+		int delta_node = delta(i, j);
+		int s = 0;
+		for (int t = (l + 1) / 2; ; t = (t + 1) / 2) {
+			if (delta(i, i + (s + t) * d) > delta_node) { s += t; }
+			if (t == 1) { break; }
+		}
+		int gamma = i + s * d + std::min(d, 0);
+		int left = std::min(i, j) == gamma ? ~gamma : gamma;
+		int right = std::max(i, j) == gamma + 1 ? ~(gamma + 1) : gamma + 1;
+		index.child[2 * i] = left;
+		index.child[2 * i + 1] = right;
+		parent[left < 0 ? n_inner + ~left : left] = i;
+		parent[right < 0 ? n_inner + ~right : right] = i;
+	}, 10000);
+
+	// boxes bottom up: the second child to arrive at a node merges it
+	std::unique_ptr<std::atomic<int32_t>[]> arrived(new std::atomic<int32_t>[std::max(1, n_inner)]);
+	igl::parallel_for(n_inner, [&](int i) { arrived[i].store(0, std::memory_order_relaxed); }, 100000);
+	auto nodeBox = [&](int c) -> const Eigen::AlignedBox3f& { return index.boxes[c < 0 ? n_inner + ~c : c]; };
+	igl::parallel_for(n_leaves, [&](int l) {
+		Eigen::AlignedBox3f& box = index.boxes[n_inner + l];
+		int end = std::min(nf, (l + 1) * SurfaceIndex::LeafSize);
+		for (int s = l * SurfaceIndex::LeafSize; s < end; s++) {
+			for (int j = 0; j < 3; j++) { box.extend(index.corners[3 * s + j]); }
+		}
+		int node = parent[n_inner + l];
+		while (node >= 0 && arrived[node].fetch_add(1, std::memory_order_acq_rel) == 1) {
+			index.boxes[node] = nodeBox(index.child[2 * node]).merged(nodeBox(index.child[2 * node + 1]));
+			node = parent[node];
+		}
+	}, 1000);
+}
+
+// Triangle under each of the n UV points (u[i], v[i]) and its barycentrics.
+// Points outside every chart get the nearest point of the nearest chart.
+inline void queryUV(const UVIndex& index, int n, const float* u, const float* v, const SurfaceQueryResult& out)
+{
+	igl::parallel_for(n, [&](int q) {
+		UVIndex::Point p(u[q], v[q]);
+		float bv = 0, bw = 0, dist = 0;
+		int tri = index.corners.empty() ? -1 : spatial_internal::coveringTriangle(index, p, bv, bw);
+		if (tri < 0 && !index.corners.empty()) {
+			tri = spatial_internal::nearestTriangle(index, p, bv, bw, dist);
+		}
+		out.triangle[q] = tri;
+		out.bary1[q] = bv;
+		out.bary2[q] = bw;
+		if (out.distance) { out.distance[q] = dist; }
+	}, 1024);
+}
+
+// Nearest surface point of each of the n points (x[i], y[i], z[i]). Ties go
+// to the lower triangle index.
+inline void queryNearestSurface(const SurfaceIndex& index, int n, const float* x, const float* y, const float* z,
+	const SurfaceQueryResult& out)
+{
+	const int nf = (int)index.order.size();
+	const int n_inner = std::max(0, index.n_leaves - 1);
+	igl::parallel_for(n, [&](int q) {
+		Eigen::Vector3f p(x[q], y[q], z[q]);
+		int best = -1;
+		float best_d2 = std::numeric_limits<float>::infinity(), bv = 0, bw = 0;
+		// depth first, nearer child first; node codes as in SurfaceIndex::child
+		int stack[96];
+		int top = 0;
+		if (index.n_leaves > 0) { stack[top++] = index.n_leaves > 1 ? 0 : ~0; }
+		while (top > 0) {
+			int node = stack[--top];
+			if (node >= 0) {
+				int a = index.child[2 * node], b = index.child[2 * node + 1];
+				float da = index.boxes[a < 0 ? n_inner + ~a : a].squaredExteriorDistance(p);
+				float db = index.boxes[b < 0 ? n_inner + ~b : b].squaredExteriorDistance(p);
+				if (da > db) {
+					std::swap(a, b);
+					std::swap(da, db);
+				}
+				if (db <= best_d2) { stack[top++] = b; }
+				if (da <= best_d2) { stack[top++] = a; }
+				continue;
+			}
+			int l = ~node;
+			if (index.boxes[n_inner + l].squaredExteriorDistance(p) > best_d2) { continue; }
+			int end = std::min(nf, (l + 1) * SurfaceIndex::LeafSize);
+			for (int s = l * SurfaceIndex::LeafSize; s < end; s++) {
+				const Eigen::Vector3f& a = index.corners[3 * s];
+				const Eigen::Vector3f& b = index.corners[3 * s + 1];
+				const Eigen::Vector3f& c = index.corners[3 * s + 2];
+				float tv, tw;
+				spatial_internal::closestOnTriangle(p, a, b, c, tv, tw);
+				float d2 = ((1 - tv - tw) * a + tv * b + tw * c - p).squaredNorm();
+				int i = index.order[s];
+				if (d2 < best_d2 || (d2 == best_d2 && i < best)) {
+					best = i;
+					best_d2 = d2;
+					bv = tv;
+					bw = tw;
+				}
+			}
+		}
+		out.triangle[q] = best;
+		out.bary1[q] = bv;
+		out.bary2[q] = bw;
+		if (out.distance) { out.distance[q] = std::sqrt(best_d2); }
+	}, 1024);
+}
@@ -0,0 +1,163 @@
+#pragma once
+#include <vector>
+#include <cmath>
+#include <Eigen/Eigen>
+#include <igl/parallel_for.h>
+#include "MeshRemap.h"
+
+// Per-vertex tangent frames for a remapped mesh (V/TC/N share the index F).
+//
+// Follows the MikkTSpace conventions: each corner contributes its face tangent
+// projected onto the vertex normal and weighted by the corner angle measured
+// in the tangent plane, and the bitangent is rebuilt by the consumer as
+// T.w * cross(N, T.xyz). Faces of opposite UV orientation never share a
+// tangent: remapMesh keeps mirrored-UV centerlines as one vertex (same v and
+// vt), so such vertices are split here and V / N / TC / C / FTC / FN and the
+// remap maps grow accordingly.
+// Faces are processed in parallel; the per-vertex sums always run over the
+// corners in face order, so the result does not depend on the thread count.
+inline void computeTangents(MatrixMesh& mesh_cpu)
+{
+	const auto& V = mesh_cpu.V;
+	const auto& N = mesh_cpu.N;
+	const auto& TC = mesh_cpu.TC;
+	auto& F = mesh_cpu.F;
+	const int nf = (int)F.rows();
+
+	// per-corner weighted tangent / bitangent, corner c = 3 * face + j, and
+	// the UV orientation of every face (0 for degenerate UVs)
+	Eigen::MatrixXd corner_t(3 * nf, 3), corner_b(3 * nf, 3);
+	std::vector<signed char> orientation(nf);
+	igl::parallel_for(nf, [&](int i) {
+		Eigen::RowVector3d p[3];
+		Eigen::RowVector2d uv[3];
+		for (int j = 0; j < 3; j++) {
+			p[j] = V.row(F(i, j));
+			uv[j] = TC.row(F(i, j));
+		}
+		Eigen::RowVector3d e1 = p[1] - p[0], e2 = p[2] - p[0];
+		Eigen::RowVector2d d1 = uv[1] - uv[0], d2 = uv[2] - uv[0];
+		double r = d1.x() * d2.y() - d2.x() * d1.y();
+		Eigen::RowVector3d sdir = e1 * d2.y() - e2 * d1.y();
+		Eigen::RowVector3d tdir = e2 * d1.x() - e1 * d2.x();
+		if (r < 0) {
+			sdir = -sdir;
+			tdir = -tdir;
+		}
+		orientation[i] = r > 0 ? 1 : (r < 0 ? -1 : 0);
+		for (int j = 0; j < 3; j++) {
+			int c = 3 * i + j;
+			corner_t.row(c).setZero();
+			corner_b.row(c).setZero();
+			if (r == 0) {
+				continue;
+			}
+			Eigen::RowVector3d n = N.row(F(i, j));
+			Eigen::RowVector3d a = p[(j + 1) % 3] - p[j];
+			Eigen::RowVector3d b = p[(j + 2) % 3] - p[j];
+			a -= n * n.dot(a);
+			b -= n * n.dot(b);
+			double la = a.norm(), lb = b.norm();
+			if (la == 0 || lb == 0) {
+				continue;
+			}
+			double angle = std::acos(std::max(-1.0, std::min(1.0, a.dot(b) / (la * lb))));
+			Eigen::RowVector3d t = sdir - n * n.dot(sdir);
+			Eigen::RowVector3d bt = tdir - n * n.dot(tdir);
+			if (t.norm() > 0) {
+				corner_t.row(c) = t.normalized() * angle;
+			}
+			if (bt.norm() > 0) {
+				corner_b.row(c) = bt.normalized() * angle;
+			}
+		}
+	}, 1000);
+
+	// split vertices shared by both UV orientations: the negative corners
+	// move to a copy appended after the original vertices
+	const int nv_old = (int)V.rows();
+	std::vector<unsigned char> used(nv_old, 0);
+	for (int i = 0; i < nf; i++) {
+		if (orientation[i] == 0) { continue; }
+		for (int j = 0; j < 3; j++) { used[F(i, j)] |= orientation[i] > 0 ? 1 : 2; }
+	}
+	std::vector<int> split(nv_old, -1);
+	std::vector<int> split_from;
+	for (int v = 0; v < nv_old; v++) {
+		if (used[v] == 3) {
+			split[v] = nv_old + (int)split_from.size();
+			split_from.push_back(v);
+		}
+	}
+	if (!split_from.empty()) {
+		const int n_split = (int)split_from.size();
+		const bool same_ftc = mesh_cpu.FTC.rows() == nf, same_fn = mesh_cpu.FN.rows() == nf;
+		igl::parallel_for(nf, [&](int i) {
+			if (orientation[i] >= 0) { return; }
+			for (int j = 0; j < 3; j++) {
+				int v = split[F(i, j)];
+				if (v >= 0) {
+					F(i, j) = v;
+					if (same_ftc) { mesh_cpu.FTC(i, j) = v; }
+					if (same_fn) { mesh_cpu.FN(i, j) = v; }
+				}
+			}
+		}, 10000);
+		auto grow = [&](Eigen::MatrixXd& M) {
+			if (M.rows() != nv_old) { return; }
+			M.conservativeResize(nv_old + n_split, M.cols());
+			for (int k = 0; k < n_split; k++) { M.row(nv_old + k) = M.row(split_from[k]); }
+		};
+		grow(mesh_cpu.V);
+		grow(mesh_cpu.N);
+		grow(mesh_cpu.TC);
+		grow(mesh_cpu.C);
+		auto growMap = [&](std::vector<int>& map) {
+			if ((int)map.size() != nv_old) { return; }
+			for (int k = 0; k < n_split; k++) { map.push_back(map[split_from[k]]); }
+		};
+		growMap(mesh_cpu.VNew2VOld);
+		growMap(mesh_cpu.VNew2TcOld);
+	}
+	const int nv = (int)mesh_cpu.V.rows();
+
+	// vertex -> corner lists
+	std::vector<int> v_corner_start(nv + 1, 0);
+	for (int i = 0; i < nf; i++) {
+		for (int j = 0; j < 3; j++) {
+			v_corner_start[F(i, j) + 1]++;
+		}
+	}
+	for (int i = 0; i < nv; i++) {
+		v_corner_start[i + 1] += v_corner_start[i];
+	}
+	std::vector<int> v_corner(3 * nf);
+	{
+		std::vector<int> fill(v_corner_start.begin(), v_corner_start.end() - 1);
+		for (int c = 0; c < 3 * nf; c++) {
+			v_corner[fill[F(c / 3, c % 3)]++] = c;
+		}
+	}
+
+	mesh_cpu.T.resize(nv, 4);
+	igl::parallel_for(nv, [&](int i) {
+		Eigen::RowVector3d t = Eigen::RowVector3d::Zero();
+		Eigen::RowVector3d b = Eigen::RowVector3d::Zero();
+		for (int k = v_corner_start[i]; k < v_corner_start[i + 1]; k++) {
+			t += corner_t.row(v_corner[k]);
+			b += corner_b.row(v_corner[k]);
+		}
+		Eigen::RowVector3d n = N.row(i);
+		// Gram-Schmidt against the normal
+		t -= n * n.dot(t);
+		if (t.norm() < 1e-12) {
+			// no usable uv gradient, pick any direction orthogonal to n
+			Eigen::RowVector3d axis = std::abs(n.x()) < 0.9 ? Eigen::RowVector3d(1, 0, 0) : Eigen::RowVector3d(0, 1, 0);
+			t = axis - n * n.dot(axis);
+		}
+		t.normalize();
+		double w = n.cross(t).dot(b) < 0 ? -1.0 : 1.0;
+		mesh_cpu.T.block<1, 3>(i, 0) = t;
+		mesh_cpu.T(i, 3) = w;
+	}, 1000);
+}
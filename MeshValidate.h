@@ -0,0 +1,203 @@
+#pragma once
+#include <vector>
+#include <cstdio>
+#include <algorithm>
+#include <Eigen/Eigen>
+#include <igl/parallel_for.h>
+#include "MeshRemap.h"
+
+// Faces with one kind of problem: how many, and the first few of them
+struct ValidationIssue
+{
+	int count = 0;
+	// lowest offending face indices, at most ValidationReport::MaxSamples
+	std::vector<int> faces;
+};
+
+// Result of validateMesh. The remap kernels index V / TC with F / FTC
+// without checks, so a mesh must be Ok (or sanitized) before remapMesh.
+struct ValidationReport
+{
+	static const int MaxSamples = 5;
+	// F / FTC / FN / FM / FP rows disagree, or C is not indexed like V;
+	// not fixable
+	bool size_mismatch = false;
+	// F outside V
+	ValidationIssue position;
+	// FTC outside TC, and -1 (face written without vt, or no FTC at all)
+	ValidationIssue texcoord, missing_texcoord;
+	// FN outside N, and -1 (face written without vn)
+	ValidationIssue normal, missing_normal;
+
+	bool Ok() const
+	{
+		return !size_mismatch && position.count == 0 && texcoord.count == 0 && missing_texcoord.count == 0 &&
+			normal.count == 0 && missing_normal.count == 0;
+	}
+
+	void Print(const char* name) const
+	{
+		if (size_mismatch) {
+			printf("[validate] %s: face index or color arrays have different sizes\n", name);
+		}
+		const ValidationIssue* issues[] = { &position, &texcoord, &missing_texcoord, &normal, &missing_normal };
+		const char* what[] = { "position index out of range", "texcoord index out of range", "no texcoord index",
+			"normal index out of range", "no normal index" };
+		for (int k = 0; k < 5; k++) {
+			if (issues[k]->count == 0) { continue; }
+			printf("[validate] %s: %d faces with %s (first:", name, issues[k]->count, what[k]);
+			for (int f : issues[k]->faces) { printf(" %d", f); }
+			printf(")\n");
+		}
+	}
+};
+
+namespace validate_internal
+{
+	// rows per block of the parallel checks
+	const int BlockRows = 1 << 14;
+
+	inline void add(ValidationIssue& issue, int face)
+	{
+		issue.count++;
+		if ((int)issue.faces.size() < ValidationReport::MaxSamples) {
+			issue.faces.push_back(face);
+		}
+	}
+
+	inline void merge(ValidationIssue& total, const ValidationIssue& block)
+	{
+		total.count += block.count;
+		for (int f : block.faces) {
+			if ((int)total.faces.size() == ValidationReport::MaxSamples) { break; }
+			total.faces.push_back(f);
+		}
+	}
+
+	// Faces of I with an index outside [0, limit) go to bad. With missing,
+	// -1 marks an absent index and those faces go there instead. Blocks
+	// whose min / max are in range are accepted without looking at rows.
+	inline void checkRange(const Eigen::MatrixXi& I, int limit, ValidationIssue& bad, ValidationIssue* missing)
+	{
+		const int rows = (int)I.rows();
+		const int n_blocks = (rows + BlockRows - 1) / BlockRows;
+		std::vector<ValidationIssue> block_bad(n_blocks), block_missing(n_blocks);
+		igl::parallel_for(n_blocks, [&](int b) {
+			const int first = b * BlockRows;
+			const int n = std::min(BlockRows, rows - first);
+			auto block = I.middleRows(first, n);
+			if (block.minCoeff() >= 0 && block.maxCoeff() < limit) {
+				return;
+			}
+			for (int i = first; i < first + n; i++) {
+				bool is_bad = false, is_missing = false;
+				for (int j = 0; j < 3; j++) {
+					int k = I(i, j);
+					if (missing && k == -1) {
+						is_missing = true;
+					}
+					else if (k < 0 || k >= limit) {
+						is_bad = true;
+					}
+				}
+				if (is_bad) { add(block_bad[b], i); }
+				if (is_missing) { add(block_missing[b], i); }
+			}
+		}, 1);
+		for (int b = 0; b < n_blocks; b++) {
+			merge(bad, block_bad[b]);
+			if (missing) { merge(*missing, block_missing[b]); }
+		}
+	}
+}
+
+// Check every face index of a loaded (not yet remapped) mesh in parallel.
+// Returns report.Ok().
+inline bool validateMesh(const MatrixMesh& mesh_cpu, ValidationReport& report)
+{
+	report = ValidationReport();
+	const int nf = (int)mesh_cpu.F.rows();
+	const bool has_texcoords = mesh_cpu.FTC.rows() > 0;
+	const bool has_normals = mesh_cpu.FN.rows() > 0;
+	report.size_mismatch = (has_texcoords && mesh_cpu.FTC.rows() != nf) || (has_normals && mesh_cpu.FN.rows() != nf) ||
+		(mesh_cpu.FM.size() > 0 && mesh_cpu.FM.size() != nf) || (mesh_cpu.FP.size() > 0 && mesh_cpu.FP.size() != nf) ||
+		(mesh_cpu.C.rows() > 0 && mesh_cpu.C.rows() != mesh_cpu.V.rows());
+	if (report.size_mismatch) {
+		return false;
+	}
+	validate_internal::checkRange(mesh_cpu.F, (int)mesh_cpu.V.rows(), report.position, nullptr);
+	if (has_texcoords) {
+		validate_internal::checkRange(mesh_cpu.FTC, (int)mesh_cpu.TC.rows(), report.texcoord, &report.missing_texcoord);
+	}
+	else {
+		// file without any vt: every face lacks its texcoords
+		for (int i = 0; i < nf; i++) { validate_internal::add(report.missing_texcoord, i); }
+	}
+	if (has_normals) {
+		validate_internal::checkRange(mesh_cpu.FN, (int)mesh_cpu.N.rows(), report.normal, &report.missing_normal);
+	}
+	return report.Ok();
+}
+
+// Fix what validateMesh found: faces with out of range position or texcoord
+// indices are dropped, absent texcoords (including a missing FTC) point to an
+// extra (0, 0) row of TC, and FN is cleared if it has any problem (remapMesh
+// recomputes normals).
+// Returns false if the mesh cannot be fixed (size_mismatch).
+inline bool sanitizeMesh(MatrixMesh& mesh_cpu, const ValidationReport& report)
+{
+	if (report.size_mismatch) {
+		return false;
+	}
+	if (report.normal.count > 0 || report.missing_normal.count > 0) {
+		mesh_cpu.FN.resize(0, 3);
+	}
+
+	const int nf = (int)mesh_cpu.F.rows();
+	if (mesh_cpu.FTC.rows() == 0) {
+		mesh_cpu.FTC = Eigen::MatrixXi::Constant(nf, 3, -1);
+	}
+	const int nv = (int)mesh_cpu.V.rows();
+	const int ntc = (int)mesh_cpu.TC.rows();
+	if (report.position.count > 0 || report.texcoord.count > 0) {
+		std::vector<char> keep(nf);
+		igl::parallel_for(nf, [&](int i) {
+			bool ok = true;
+			for (int j = 0; j < 3; j++) {
+				ok = ok && mesh_cpu.F(i, j) >= 0 && mesh_cpu.F(i, j) < nv;
+				ok = ok && mesh_cpu.FTC(i, j) >= -1 && mesh_cpu.FTC(i, j) < ntc;
+			}
+			keep[i] = ok;
+		}, 10000);
+		const bool has_normals = mesh_cpu.FN.rows() == nf;
+		const bool has_materials = mesh_cpu.FM.size() == nf;
+		const bool has_polygons = mesh_cpu.FP.size() == nf;
+		int k = 0;
+		for (int i = 0; i < nf; i++) {
+			if (!keep[i]) { continue; }
+			mesh_cpu.F.row(k) = mesh_cpu.F.row(i);
+			mesh_cpu.FTC.row(k) = mesh_cpu.FTC.row(i);
+			if (has_normals) { mesh_cpu.FN.row(k) = mesh_cpu.FN.row(i); }
+			if (has_materials) { mesh_cpu.FM[k] = mesh_cpu.FM[i]; }
+			if (has_polygons) { mesh_cpu.FP[k] = mesh_cpu.FP[i]; }
+			k++;
+		}
+		mesh_cpu.F.conservativeResize(k, 3);
+		mesh_cpu.FTC.conservativeResize(k, 3);
+		if (has_normals) { mesh_cpu.FN.conservativeResize(k, 3); }
+		if (has_materials) { mesh_cpu.FM.conservativeResize(k); }
+		if (has_polygons) { mesh_cpu.FP.conservativeResize(k); }
+	}
+
+	if (report.missing_texcoord.count > 0) {
+		mesh_cpu.TC.conservativeResize(ntc + 1, 2);
+		mesh_cpu.TC.row(ntc).setZero();
+		auto& ftc = mesh_cpu.FTC;
+		igl::parallel_for((int)ftc.rows(), [&](int i) {
+			for (int j = 0; j < 3; j++) {
+				if (ftc(i, j) == -1) { ftc(i, j) = ntc; }
+			}
+		}, 10000);
+	}
+	return true;
+}
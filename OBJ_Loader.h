@@ -5,9 +5,14 @@
 #include <vector>
 #include <string>
 #include <fstream>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
 #include <math.h>
+#include <cstdlib>
 #include <Eigen/Eigen>
 #include <boost/filesystem.hpp>
+#include "TaskControl.h"
 
 // Print progress to console while loading (large models)
 //#define OBJL_CONSOLE_OUTPUT
@@ -69,22 +74,20 @@ namespace objl
 
 		Mesh(std::vector<Eigen::Vector3i> &_PositionIndices,
 			std::vector<Eigen::Vector3i> &_TextureIndices,
-			std::vector<Eigen::Vector3i> &_NormalIndices)
-			: PositionIndices(_PositionIndices), TextureIndices(_TextureIndices), NormalIndices(_NormalIndices)
+			std::vector<Eigen::Vector3i> &_NormalIndices,
+			std::vector<int> &_PolygonIndices)
+			: PositionIndices(_PositionIndices), TextureIndices(_TextureIndices), NormalIndices(_NormalIndices),
+			PolygonIndices(_PolygonIndices)
 		{
-			for (int i = 0; i < TextureIndices.size(); ++i) {
-				if (TextureIndices[i][0] < 0 || TextureIndices[i][1] < 0 || TextureIndices[i][2] < 0) {
-					TextureIndices.clear();
-					break;
-				}
-			}
-
-			for (int i = 0; i < NormalIndices.size(); ++i) {
-				if (NormalIndices[i][0] < 0 || NormalIndices[i][1] < 0 || NormalIndices[i][2] < 0) {
-					NormalIndices.clear();
-					break;
-				}
-			}
+			// Drop texture / normal indices only if no face has any; faces
+			// missing some keep -1 there (see validateMesh)
+			if (std::all_of(TextureIndices.begin(), TextureIndices.end(),
+				[](const Eigen::Vector3i &t) { return (t.array() == -1).all(); }))
+				TextureIndices.clear();
+
+			if (std::all_of(NormalIndices.begin(), NormalIndices.end(),
+				[](const Eigen::Vector3i &n) { return (n.array() == -1).all(); }))
+				NormalIndices.clear();
 		}
 
 		void GetTriangleIndices(Eigen::MatrixXi &F, Eigen::MatrixXi &FTC, Eigen::MatrixXi &FN)
@@ -108,8 +111,12 @@ namespace objl
 		std::vector<Eigen::Vector3i> PositionIndices;
 		std::vector<Eigen::Vector3i> TextureIndices;
 		std::vector<Eigen::Vector3i> NormalIndices;
+		// Source polygon (0-based "f" line of the file) of every triangle
+		std::vector<int> PolygonIndices;
 		// Material
 		Material MeshMaterial;
+		// Interned material id (Loader::MaterialNames), -1 without usemtl
+		int MaterialID = -1;
 	};
 
 	// Namespace: Math
@@ -302,10 +309,21 @@ namespace objl
 			return elements[idx];
 		}
 
-		inline const int getIndex(std::string &index)
+		// Parse a one-based or (negative) relative OBJ index at p and move p
+		// past it. Returns the zero-based index, count being the number of
+		// elements read so far, or -1 if there is none
+		inline int getIndex(const char *&p, int count)
 		{
-			int idx = std::stoi(index) - 1;
-			return idx;
+			if (*p != '-' && *p != '+' && (*p < '0' || *p > '9'))
+				return -1;
+			char *end;
+			long idx = strtol(p, &end, 10);
+			if (end == p)
+				return -1;
+			p = end;
+			if (idx < 0)
+				return count + int(idx);
+			return int(idx) - 1;
 		}
 	}
 
@@ -331,7 +349,10 @@ namespace objl
 		//
 		// If the file is unable to be found
 		// or unable to be loaded return false
-		bool LoadFile(std::string Path)
+		//
+		// control (optional) receives the fraction of the file parsed and
+		// can cancel the load, in which case false is returned as well
+		bool LoadFile(std::string Path, const TaskControl *control = nullptr)
 		{
 			// If the file is not an .obj file return false
 			if (Path.substr(Path.size() - 4, 4) != ".obj")
@@ -346,14 +367,23 @@ namespace objl
 			LoadedPath = Path;
 			LoadedMeshes.clear();
 			LoadedPositions.clear();
+			LoadedColors.clear();
 			LoadedNormals.clear();
 			LoadedTCoords.clear();
+			MaterialNames.clear();
+			MaterialIDs.clear();
+			skippedFaces = 0;
 
 			std::vector<Eigen::Vector3i> PositionIndices;
 			std::vector<Eigen::Vector3i> NormalIndices;
 			std::vector<Eigen::Vector3i> TextureIndices;
+			std::vector<int> PolygonIndices;
+			int polygonCount = 0;
 
-			std::vector<std::string> MeshMatNames;
+			// Material of the faces currently being collected
+			int currentMaterial = -1;
+			// Names of the meshes created so far
+			std::unordered_set<std::string> meshNames;
 
 			bool listening = false;
 			std::string meshname;
@@ -365,9 +395,25 @@ namespace objl
 			unsigned int outputIndicator = outputEveryNth;
 			#endif
 
+			std::streamoff fileSize = 0;
+			if (control)
+			{
+				file.seekg(0, std::ios::end);
+				fileSize = std::max<std::streamoff>(1, file.tellg());
+				file.seekg(0, std::ios::beg);
+			}
+			const unsigned int checkEveryNth = 1 << 14;
+			unsigned int lineCount = 0;
+
 			std::string curline;
 			while (std::getline(file, curline))
 			{
+				if (control && (++lineCount % checkEveryNth) == 0)
+				{
+					if (!control->Checkpoint(float(file.tellg()) / float(fileSize)))
+						return false;
+				}
+
 				#ifdef OBJL_CONSOLE_OUTPUT
 				if ((outputIndicator = ((outputIndicator + 1) % outputEveryNth)) == 1)
 				{
@@ -379,7 +425,7 @@ namespace objl
 							<< "\t| texcoords > " << LoadedTCoords.size()
 							<< "\t| normals > " << LoadedNormals.size()
 							<< "\t| triangles > " << (PositionIndices.size() / 3)
-							<< (!MeshMatNames.empty() ? "\t| material: " + MeshMatNames.back() : "");
+							<< (currentMaterial >= 0 ? "\t| material: " + MaterialNames[currentMaterial] : "");
 					}
 				}
 				#endif
@@ -407,16 +453,19 @@ namespace objl
 						if (!PositionIndices.empty() && !LoadedPositions.empty())
 						{
 							// Create Mesh
-							tempMesh = Mesh(PositionIndices, TextureIndices, NormalIndices);
+							tempMesh = Mesh(PositionIndices, TextureIndices, NormalIndices, PolygonIndices);
 							tempMesh.MeshName = meshname;
+							tempMesh.MaterialID = currentMaterial;
 
 							// Insert Mesh
+							meshNames.insert(tempMesh.MeshName);
 							LoadedMeshes.push_back(tempMesh);
 
 							// Cleanup
 							PositionIndices.clear();
 							NormalIndices.clear();
 							TextureIndices.clear();
+							PolygonIndices.clear();
 							meshname.clear();
 
 							meshname = algorithm::tail(curline);
@@ -450,6 +499,18 @@ namespace objl
 					vpos[2] = std::stod(spos[2]);
 
 					LoadedPositions.push_back(vpos);
+
+					// Optional vertex color - v x y z r g b
+					if (spos.size() >= 6)
+					{
+						Eigen::Vector3f vcol(std::stof(spos[3]), std::stof(spos[4]), std::stof(spos[5]));
+						LoadedColors.resize(LoadedPositions.size() - 1, Eigen::Vector3f::Ones());
+						LoadedColors.push_back(vcol);
+					}
+					else if (!LoadedColors.empty())
+					{
+						LoadedColors.push_back(Eigen::Vector3f::Ones());
+					}
 				}
 				// Generate a Vertex Texture Coordinate
 				if (algorithm::firstToken(curline) == "vt")
@@ -479,42 +540,37 @@ namespace objl
 				// Generate a Face (vertices & indices)
 				if (algorithm::firstToken(curline) == "f")
 				{
-					// Generate the vertices
-					Eigen::Vector3i PositionIdx, TextureIdx, NormalIdx;
-					ReadTriangleIndicesRawOBJ(PositionIdx, TextureIdx, NormalIdx, curline);
-					PositionIndices.emplace_back(PositionIdx);
-					TextureIndices.emplace_back(TextureIdx);
-					NormalIndices.emplace_back(NormalIdx);
+					// Triangulate the polygon into the index lists
+					ReadPolygonIndicesRawOBJ(curline, polygonCount++,
+						PositionIndices, TextureIndices, NormalIndices, PolygonIndices);
 				}
 				// Get Mesh Material Name
 				if (algorithm::firstToken(curline) == "usemtl")
 				{
-					MeshMatNames.push_back(algorithm::tail(curline));
+					int nextMaterial = InternMaterial(algorithm::tail(curline));
 
 					// Create new Mesh, if Material changes within a group
 					if (!PositionIndices.empty() && !LoadedPositions .empty())
 					{
 						// Create Mesh
-						tempMesh = Mesh(PositionIndices, TextureIndices, NormalIndices);
-						tempMesh.MeshName = meshname;
+						tempMesh = Mesh(PositionIndices, TextureIndices, NormalIndices, PolygonIndices);
+						tempMesh.MaterialID = currentMaterial;
 						int i = 2;
-						while(1) {
-							tempMesh.MeshName = meshname + "_" + std::to_string(i);
-
-							for (auto &m : LoadedMeshes)
-								if (m.MeshName == tempMesh.MeshName)
-									continue;
-							break;
-						}
+						do {
+							tempMesh.MeshName = meshname + "_" + std::to_string(i++);
+						} while (meshNames.count(tempMesh.MeshName));
 
 						// Insert Mesh
+						meshNames.insert(tempMesh.MeshName);
 						LoadedMeshes.push_back(tempMesh);
 
 						// Cleanup
 						PositionIndices.clear();
 						TextureIndices.clear();
 						NormalIndices.clear();
+						PolygonIndices.clear();
 					}
+					currentMaterial = nextMaterial;
 
 					#ifdef OBJL_CONSOLE_OUTPUT
 					outputIndicator = 0;
@@ -563,8 +619,9 @@ namespace objl
 			if (!PositionIndices.empty() && !LoadedPositions.empty())
 			{
 				// Create Mesh
-				tempMesh = Mesh(PositionIndices, TextureIndices, NormalIndices);
+				tempMesh = Mesh(PositionIndices, TextureIndices, NormalIndices, PolygonIndices);
 				tempMesh.MeshName = meshname;
+				tempMesh.MaterialID = currentMaterial;
 
 				// Insert Mesh
 				LoadedMeshes.push_back(tempMesh);
@@ -572,21 +629,27 @@ namespace objl
 
 			file.close();
 
-			// Set Materials for each Mesh
-			for (int i = 0; i < MeshMatNames.size(); i++)
+			if (skippedFaces > 0)
+				printf("[OBJ Loader][ERROR] %d faces with fewer than 3 vertices skipped!\n", skippedFaces);
+
+			// Resolve interned material ids against the loaded materials
+			std::unordered_map<std::string, int> loadedByName;
+			for (int j = 0; j < int(LoadedMaterials.size()); j++)
+				loadedByName.emplace(LoadedMaterials[j].name, j);
+
+			MaterialIndex.assign(MaterialNames.size(), -1);
+			for (int i = 0; i < int(MaterialNames.size()); i++)
 			{
-				std::string matname = MeshMatNames[i];
+				auto it = loadedByName.find(MaterialNames[i]);
+				if (it != loadedByName.end())
+					MaterialIndex[i] = it->second;
+			}
 
-				// Find corresponding material name in loaded materials
-				// when found copy material variables into mesh material
-				for (int j = 0; j < LoadedMaterials.size(); j++)
-				{
-					if (LoadedMaterials[j].name == matname)
-					{
-						LoadedMeshes[i].MeshMaterial = LoadedMaterials[j];
-						break;
-					}
-				}
+			// Set Materials for each Mesh
+			for (auto &m : LoadedMeshes)
+			{
+				if (m.MaterialID >= 0 && MaterialIndex[m.MaterialID] >= 0)
+					m.MeshMaterial = LoadedMaterials[MaterialIndex[m.MaterialID]];
 			}
 
 			if (LoadedMeshes.empty() && LoadedPositions.empty())
@@ -617,6 +680,62 @@ namespace objl
 					TC(i, j) = LoadedTCoords[i][j];
 		}
 
+		// Per-position colors, empty if the file has none
+		void GetLoadedColors(Eigen::MatrixXd &C)
+		{
+			C.resize(LoadedColors.size(), 3);
+			for (int i = 0; i < C.rows(); ++i)
+				for (int j = 0; j < 3; ++j)
+					C(i, j) = LoadedColors[i][j];
+		}
+
+		// Concatenate the triangles of all meshes, FM receives the material id
+		// (MaterialNames) of every face. FTC / FN are left empty if no mesh
+		// has them, faces without them are -1.
+		void GetAllTriangleIndices(Eigen::MatrixXi &F, Eigen::MatrixXi &FTC, Eigen::MatrixXi &FN, Eigen::VectorXi &FM)
+		{
+			int nf = 0;
+			bool hasTC = false, hasN = false;
+			for (auto &m : LoadedMeshes)
+			{
+				nf += int(m.PositionIndices.size());
+				hasTC = hasTC || !m.TextureIndices.empty();
+				hasN = hasN || !m.NormalIndices.empty();
+			}
+
+			F.resize(nf, 3);
+			FTC.resize(hasTC ? nf : 0, 3);
+			FN.resize(hasN ? nf : 0, 3);
+			FM.resize(nf);
+			int k = 0;
+			for (auto &m : LoadedMeshes)
+			{
+				for (int i = 0; i < int(m.PositionIndices.size()); ++i, ++k)
+				{
+					F.row(k) = m.PositionIndices[i];
+					if (hasTC)
+						FTC.row(k) = m.TextureIndices.empty() ? Eigen::Vector3i::Constant(-1) : m.TextureIndices[i];
+					if (hasN)
+						FN.row(k) = m.NormalIndices.empty() ? Eigen::Vector3i::Constant(-1) : m.NormalIndices[i];
+					FM[k] = m.MaterialID;
+				}
+			}
+		}
+
+		// Source polygon of every triangle, in GetAllTriangleIndices order
+		void GetAllPolygonIndices(Eigen::VectorXi &FP)
+		{
+			int nf = 0;
+			for (auto &m : LoadedMeshes)
+				nf += int(m.PolygonIndices.size());
+
+			FP.resize(nf);
+			int k = 0;
+			for (auto &m : LoadedMeshes)
+				for (int p : m.PolygonIndices)
+					FP[k++] = p;
+		}
+
 		std::string LoadedPath;
 
 		// Loaded Mesh Objects
@@ -624,6 +743,8 @@ namespace objl
 
 		// Position Vector
 		std::vector<Eigen::Vector3f> LoadedPositions;
+		// Vertex Color Vector (white for positions without a color)
+		std::vector<Eigen::Vector3f> LoadedColors;
 		// Normal Vector
 		std::vector<Eigen::Vector3f> LoadedNormals;
 		// Texture Coordinate Vector
@@ -632,90 +753,170 @@ namespace objl
 		// Loaded Material Objects
 		std::vector<Material> LoadedMaterials;
 
+		// Material names in order of first usemtl, indexed by Mesh::MaterialID
+		std::vector<std::string> MaterialNames;
+		// Hashed name -> MaterialNames index
+		std::unordered_map<std::string, int> MaterialIDs;
+		// MaterialNames index -> LoadedMaterials index, -1 if not found in any mtllib
+		std::vector<int> MaterialIndex;
+
 	private:
-		// Read triangle indices from raw obj
-		void ReadTriangleIndicesRawOBJ(Eigen::Vector3i &PositionIdx,
-			Eigen::Vector3i &TextureIdx, Eigen::Vector3i &NormalIdx,
-			std::string icurline)
+		// Return the id of a material name, assigning a new one on first use
+		int InternMaterial(const std::string &name)
+		{
+			auto it = MaterialIDs.emplace(name, int(MaterialNames.size()));
+			if (it.second)
+				MaterialNames.push_back(name);
+			return it.first->second;
+		}
+
+		// Faces with fewer than three vertices in the file being loaded
+		int skippedFaces = 0;
+
+		// Corners (position, texture, normal index) of the polygon being read
+		// and its ear clipping state, reused across faces
+		std::vector<Eigen::Vector3i> polyCorners;
+		std::vector<Eigen::Vector2f> polyProjected;
+		std::vector<int> polyRing;
+
+		// Read a polygon from raw obj and append its triangles: a fan if it is
+		// convex, ear clipping in the plane of its Newell normal otherwise.
+		// Missing texture / normal indices are -1. Faces with fewer than three
+		// vertices are skipped and false is returned.
+		bool ReadPolygonIndicesRawOBJ(const std::string &icurline, int polygon,
+			std::vector<Eigen::Vector3i> &PositionIndices, std::vector<Eigen::Vector3i> &TextureIndices,
+			std::vector<Eigen::Vector3i> &NormalIndices, std::vector<int> &PolygonIndices)
 		{
-			std::vector<std::string> sface, svert;
-			algorithm::split(algorithm::tail(icurline), sface, " ");
+			// v, v/vt, v//vn or v/vt/vn per corner
+			polyCorners.clear();
+			const char *p = icurline.c_str() + icurline.find('f') + 1;
+			while (true)
+			{
+				while (*p == ' ' || *p == '\t' || *p == '\r')
+					p++;
+				if (*p == '\0' || *p == '#')
+					break;
 
-			if (sface.size() != 3) {
-				printf("[OBJ Loader][ERROR] only triangle is supported!\n");
-				return;
+				Eigen::Vector3i corner(-1, -1, -1);
+				corner[0] = algorithm::getIndex(p, int(LoadedPositions.size()));
+				if (*p == '/')
+				{
+					p++;
+					corner[1] = algorithm::getIndex(p, int(LoadedTCoords.size()));
+					if (*p == '/')
+					{
+						p++;
+						corner[2] = algorithm::getIndex(p, int(LoadedNormals.size()));
+					}
+				}
+				while (*p && *p != ' ' && *p != '\t' && *p != '\r')
+					p++;
+				polyCorners.push_back(corner);
 			}
 
-			// For every given vertex do this
-			for (int i = 0; i < int(sface.size()); i++)
+			const int n = int(polyCorners.size());
+			if (n < 3)
 			{
-				// See What type the vertex is.
-				int vtype;
-
-				algorithm::split(sface[i], svert, "/");
+				skippedFaces++;
+				return false;
+			}
 
-				// Check for just position - v1
-				if (svert.size() == 1)
+			auto addTriangle = [&](int a, int b, int c)
+			{
+				const Eigen::Vector3i &ca = polyCorners[a], &cb = polyCorners[b], &cc = polyCorners[c];
+				PositionIndices.emplace_back(ca[0], cb[0], cc[0]);
+				TextureIndices.emplace_back(ca[1], cb[1], cc[1]);
+				NormalIndices.emplace_back(ca[2], cb[2], cc[2]);
+				PolygonIndices.push_back(polygon);
+			};
+
+			// Convex: fan from the first corner. Polygons referencing positions
+			// that are not loaded (yet) are fanned as well, their geometry
+			// cannot be looked at
+			bool in_range = true;
+			for (int i = 0; i < n && in_range; i++)
+			{
+				int v = polyCorners[i][0];
+				in_range = v >= 0 && v < int(LoadedPositions.size());
+			}
+			bool convex = true;
+			Eigen::Vector3f normal = Eigen::Vector3f::Zero();
+			if (n > 3 && in_range)
+			{
+				for (int i = 0; i < n; i++)
 				{
-					// Only position
-					vtype = 1;
+					const Eigen::Vector3f &a = LoadedPositions[polyCorners[i][0]];
+					const Eigen::Vector3f &b = LoadedPositions[polyCorners[(i + 1) % n][0]];
+					normal[0] += (a[1] - b[1]) * (a[2] + b[2]);
+					normal[1] += (a[2] - b[2]) * (a[0] + b[0]);
+					normal[2] += (a[0] - b[0]) * (a[1] + b[1]);
 				}
-
-				// Check for position & texture - v1/vt1
-				if (svert.size() == 2)
+				for (int i = 0; i < n && convex; i++)
 				{
-					// Position & Texture
-					vtype = 2;
+					const Eigen::Vector3f &a = LoadedPositions[polyCorners[(i + n - 1) % n][0]];
+					const Eigen::Vector3f &b = LoadedPositions[polyCorners[i][0]];
+					const Eigen::Vector3f &c = LoadedPositions[polyCorners[(i + 1) % n][0]];
+					convex = (b - a).cross(c - b).dot(normal) >= 0;
 				}
+			}
+			if (convex)
+			{
+				for (int i = 1; i + 1 < n; i++)
+					addTriangle(0, i, i + 1);
+				return true;
+			}
+
+			// Concave: project along the dominant axis of the normal, keeping
+			// the polygon counter-clockwise, and clip ears
+			int axis = 0;
+			normal.cwiseAbs().maxCoeff(&axis);
+			int u = (axis + 1) % 3, v = (axis + 2) % 3;
+			if (normal[axis] < 0)
+				std::swap(u, v);
+			polyProjected.resize(n);
+			polyRing.resize(n);
+			for (int i = 0; i < n; i++)
+			{
+				const Eigen::Vector3f &pos = LoadedPositions[polyCorners[i][0]];
+				polyProjected[i] = Eigen::Vector2f(pos[u], pos[v]);
+				polyRing[i] = i;
+			}
+			auto area = [&](int a, int b, int c)
+			{
+				Eigen::Vector2f ab = polyProjected[b] - polyProjected[a], ac = polyProjected[c] - polyProjected[a];
+				return ab[0] * ac[1] - ab[1] * ac[0];
+			};
 
-				// Check for Position, Texture and Normal - v1/vt1/vn1
-				// or if Position and Normal - v1//vn1
-				if (svert.size() == 3)
+			int m = n, i = 0, misses = 0;
+			while (m > 3)
+			{
+				int a = polyRing[(i + m - 1) % m], b = polyRing[i], c = polyRing[(i + 1) % m];
+				bool ear = area(a, b, c) > 0;
+				for (int k = 0; k < m && ear; k++)
 				{
-					if (svert[1] != "")
-					{
-						// Position, Texture, and Normal
-						vtype = 4;
-					}
-					else
-					{
-						// Position & Normal
-						vtype = 3;
-					}
+					int q = polyRing[k];
+					if (q != a && q != b && q != c)
+						ear = !(area(a, b, q) >= 0 && area(b, c, q) >= 0 && area(c, a, q) >= 0);
 				}
-
-				// Calculate and store the vertex
-				switch (vtype)
+				// A full round without an ear means the polygon is degenerate
+				// or self-intersecting: clip anyway
+				if (ear || misses >= m)
 				{
-				case 1: // P
-					PositionIdx[i] = algorithm::getIndex(svert[0]);
-					TextureIdx[i] = -1;
-					NormalIdx[i] = -1;
-					break;
-				
-				case 2: // P/T
-					PositionIdx[i] = algorithm::getIndex(svert[0]);
-					TextureIdx[i] = algorithm::getIndex(svert[1]);
-					NormalIdx[i] = -1;
-					break;
-				
-				case 3: // P//N
-					PositionIdx[i] = algorithm::getIndex(svert[0]);
-					TextureIdx[i] = -1;
-					NormalIdx[i] = algorithm::getIndex(svert[2]);
-					break;
-				
-				case 4: // P/T/N
-					PositionIdx[i] = algorithm::getIndex(svert[0]);
-					TextureIdx[i] = algorithm::getIndex(svert[1]);
-					NormalIdx[i] = algorithm::getIndex(svert[2]);
-					break;
-				
-				default:
-					break;
-
+					addTriangle(a, b, c);
+					polyRing.erase(polyRing.begin() + i);
+					m--;
+					misses = 0;
+					if (i >= m)
+						i = 0;
+				}
+				else
+				{
+					i = (i + 1) % m;
+					misses++;
 				}
 			}
+			addTriangle(polyRing[0], polyRing[1], polyRing[2]);
+			return true;
 		}
 
 		// Load Materials from .mtl file
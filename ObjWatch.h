@@ -0,0 +1,246 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <fstream>
+#include <functional>
+#include <cstdint>
+#include <cstdio>
+#include <algorithm>
+#include <Eigen/Eigen>
+#include "OBJ_Loader.h"
+#include "MeshRemap.h"
+#ifdef __linux__
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif
+
+// Content hashes of an OBJ, one entry per block of ChunkLines lines.
+// topology hashes every record except the position payloads, so two files
+// with equal topology hashes differ at most in 'v' coordinates / colors.
+struct ObjChunk
+{
+	uint64_t hash;
+	uint64_t topology;
+	// first LoadedPositions index written by this chunk
+	int first_position;
+	int n_positions;
+};
+
+struct ObjSnapshot
+{
+	static const int ChunkLines = 1 << 16;
+	std::vector<ObjChunk> chunks;
+};
+
+namespace watch_internal
+{
+	inline uint64_t fnv1a(uint64_t h, const char* data, size_t n)
+	{
+		for (size_t i = 0; i < n; i++) {
+			h ^= (unsigned char)data[i];
+			h *= 1099511628211ull;
+		}
+		return h;
+	}
+
+	inline bool isPositionRecord(const std::string& line)
+	{
+		size_t p = line.find_first_not_of(" \t");
+		return p != std::string::npos && line[p] == 'v' && p + 1 < line.size() && (line[p + 1] == ' ' || line[p + 1] == '\t');
+	}
+
+	// Read path chunk by chunk. visit(chunk, lines) is called with the hashes
+	// filled in and the raw lines of the chunk.
+	inline bool scanChunks(const std::string& path, const std::function<bool(ObjChunk&, const std::vector<std::string>&)>& visit)
+	{
+		std::ifstream file(path);
+		if (!file.is_open()) {
+			return false;
+		}
+		const uint64_t seed = 14695981039346656037ull;
+		std::vector<std::string> lines(ObjSnapshot::ChunkLines);
+		int positions = 0;
+		bool more = true;
+		while (more) {
+			ObjChunk chunk{ seed, seed, positions, 0 };
+			int n = 0;
+			while (n < ObjSnapshot::ChunkLines && std::getline(file, lines[n])) {
+				const std::string& line = lines[n];
+				chunk.hash = fnv1a(chunk.hash, line.data(), line.size() + 1);
+				if (isPositionRecord(line)) {
+					chunk.topology = fnv1a(chunk.topology, "v", 2);
+					chunk.n_positions++;
+				}
+				else {
+					chunk.topology = fnv1a(chunk.topology, line.data(), line.size() + 1);
+				}
+				n++;
+			}
+			more = n == ObjSnapshot::ChunkLines;
+			if (n == 0) {
+				break;
+			}
+			positions += chunk.n_positions;
+			lines.resize(n);
+			bool keep_going = visit(chunk, lines);
+			lines.resize(ObjSnapshot::ChunkLines);
+			if (!keep_going) {
+				return false;
+			}
+		}
+		return true;
+	}
+}
+
+// Hash an OBJ that has just been loaded
+inline bool snapshotObj(const std::string& path, ObjSnapshot& snapshot)
+{
+	snapshot.chunks.clear();
+	return watch_internal::scanChunks(path, [&](ObjChunk& chunk, const std::vector<std::string>&) {
+		snapshot.chunks.push_back(chunk);
+		return true;
+	});
+}
+
+// Re-read path and compare it against snapshot. If only position records
+// changed, the changed chunks are re-parsed straight into
+// loader.LoadedPositions / LoadedColors, snapshot is updated and true is
+// returned. Otherwise nothing is modified and the caller has to reload.
+inline bool updatePositions(const std::string& path, ObjSnapshot& snapshot, objl::Loader& loader, int* changed_chunks = nullptr)
+{
+	struct Pending
+	{
+		int first;
+		std::vector<Eigen::Vector3f> positions, colors;
+	};
+	std::vector<ObjChunk> chunks;
+	std::vector<Pending> pending;
+	bool ok = watch_internal::scanChunks(path, [&](ObjChunk& chunk, const std::vector<std::string>& lines) {
+		size_t c = chunks.size();
+		chunks.push_back(chunk);
+		if (c >= snapshot.chunks.size() || snapshot.chunks[c].topology != chunk.topology) {
+			return false;
+		}
+		if (snapshot.chunks[c].hash == chunk.hash) {
+			return true;
+		}
+		Pending p;
+		p.first = chunk.first_position;
+		std::vector<std::string> spos;
+		for (auto& line : lines) {
+			if (!watch_internal::isPositionRecord(line)) {
+				continue;
+			}
+			objl::algorithm::split(objl::algorithm::tail(line), spos, " ");
+			if (spos.size() < 3) {
+				return false;
+			}
+			p.positions.emplace_back(std::stof(spos[0]), std::stof(spos[1]), std::stof(spos[2]));
+			if (spos.size() >= 6) {
+				p.colors.emplace_back(std::stof(spos[3]), std::stof(spos[4]), std::stof(spos[5]));
+			}
+			else {
+				p.colors.emplace_back(Eigen::Vector3f::Ones());
+			}
+		}
+		pending.push_back(std::move(p));
+		return true;
+	});
+	if (!ok || chunks.size() != snapshot.chunks.size()) {
+		return false;
+	}
+	// the loader no longer matches the snapshot (e.g. a failed reload cleared it)
+	for (auto& p : pending) {
+		size_t end = p.first + p.positions.size();
+		if (end > loader.LoadedPositions.size() || (!loader.LoadedColors.empty() && end > loader.LoadedColors.size())) {
+			return false;
+		}
+	}
+
+	for (auto& p : pending) {
+		std::copy(p.positions.begin(), p.positions.end(), loader.LoadedPositions.begin() + p.first);
+		if (!loader.LoadedColors.empty()) {
+			std::copy(p.colors.begin(), p.colors.end(), loader.LoadedColors.begin() + p.first);
+		}
+	}
+	snapshot.chunks = std::move(chunks);
+	if (changed_chunks) {
+		*changed_chunks = (int)pending.size();
+	}
+	return true;
+}
+
+// Refresh a remapped mesh after updatePositions: gather V (and C) through
+// VNew2VOld and recompute the normals. F, TC and the maps are reused as is.
+inline void regatherPositions(MatrixMesh& mesh_cpu, const objl::Loader& loader)
+{
+	const int nv = (int)mesh_cpu.VNew2VOld.size();
+	const bool has_colors = mesh_cpu.C.rows() == nv && !loader.LoadedColors.empty();
+	for (int k = 0; k < nv; k++) {
+		const Eigen::Vector3f& p = loader.LoadedPositions[mesh_cpu.VNew2VOld[k]];
+		mesh_cpu.V.row(k) = p.transpose().cast<double>();
+		if (has_colors) {
+			mesh_cpu.C.row(k) = loader.LoadedColors[mesh_cpu.VNew2VOld[k]].transpose().cast<double>();
+		}
+	}
+	igl::per_vertex_normals(mesh_cpu.V, mesh_cpu.F, mesh_cpu.N);
+}
+
+// Block and call on_change every time path is rewritten (saved in place or
+// replaced by rename). Returns false if watching is not possible; returns
+// when on_change returns false.
+inline bool watchFile(const std::string& path, const std::function<bool()>& on_change)
+{
+#ifdef __linux__
+	boost::filesystem::path p(path);
+	std::string dir = p.has_parent_path() ? p.parent_path().string() : ".";
+	std::string name = p.filename().string();
+
+	int fd = inotify_init1(IN_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+	if (inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		close(fd);
+		return false;
+	}
+
+	alignas(inotify_event) char buf[64 * 1024];
+	bool running = true;
+	while (running) {
+		bool hit = false;
+		// editors often write several times per save; wait for a quiet period
+		int timeout = -1;
+		while (true) {
+			pollfd pfd{ fd, POLLIN, 0 };
+			int r = poll(&pfd, 1, timeout);
+			if (r <= 0) {
+				break;
+			}
+			ssize_t len = read(fd, buf, sizeof(buf));
+			if (len <= 0) {
+				break;
+			}
+			for (char* e = buf; e < buf + len;) {
+				inotify_event* ev = reinterpret_cast<inotify_event*>(e);
+				if (ev->len > 0 && name == ev->name) {
+					hit = true;
+				}
+				e += sizeof(inotify_event) + ev->len;
+			}
+			timeout = hit ? 50 : -1;
+		}
+		if (hit) {
+			running = on_change();
+		}
+	}
+	close(fd);
+	return true;
+#else
+	(void)path;
+	(void)on_change;
+	printf("[OBJ Watch][ERROR] watch mode needs inotify (Linux)\n");
+	return false;
+#endif
+}
@@ -0,0 +1,484 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <list>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <Eigen/Eigen>
+#include <igl/writeOBJ.h>
+#include "OBJ_Loader.h"
+#include "MeshRemap.h"
+#include "MeshValidate.h"
+#ifndef _WIN32
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#endif
+
+// Binary protocol of the remap server, all fields in host byte order.
+//
+// request:  RemapRequest, then path_len bytes of input path and
+//           out_len bytes of output path (no terminators)
+// response: RemapReply
+//
+// RemapOpRemap loads (or takes from the cache), remaps and writes an OBJ.
+// RemapOpStats only fills the counters of the reply. A client may send
+// any number of requests over one connection, one at a time.
+const uint32_t RemapMagic = 0x504d524d;  // "MRMP"
+enum RemapOp : uint32_t
+{
+	RemapOpRemap = 1,
+	RemapOpStats = 2,
+};
+enum RemapFlags : uint32_t
+{
+	RemapFlagLowMemory = 1,
+};
+enum RemapStatus : uint32_t
+{
+	RemapStatusOk = 0,
+	RemapStatusBadRequest = 1,
+	RemapStatusLoadFailed = 2,
+	RemapStatusWriteFailed = 3,
+	RemapStatusInvalidMesh = 4,
+};
+
+struct RemapRequest
+{
+	uint32_t magic;
+	uint32_t op;
+	uint32_t flags;
+	uint32_t path_len;
+	uint32_t out_len;
+};
+
+struct RemapReply
+{
+	uint32_t status;
+	uint32_t cache_hit;
+	uint32_t vertices;
+	uint32_t faces;
+	// this job
+	uint64_t load_us, remap_us, write_us, total_us;
+	// all jobs served so far
+	uint64_t jobs, mean_us, max_us;
+};
+
+// Identity of one version of a file. Two saves within the same second
+// usually still differ in the nanoseconds or in the size.
+struct FileStamp
+{
+	uint64_t size = 0;
+	int64_t mtime_ns = 0;
+
+	bool operator!=(const FileStamp& o) const { return size != o.size || mtime_ns != o.mtime_ns; }
+};
+
+// Parsed, not yet remapped meshes keyed by path, evicted least recently used
+class MeshCache
+{
+public:
+	explicit MeshCache(size_t capacity) : capacity(capacity) {}
+
+	std::shared_ptr<const MatrixMesh> Find(const std::string& path, const FileStamp& stamp)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = entries.find(path);
+		if (it == entries.end()) {
+			return nullptr;
+		}
+		if (it->second->stamp != stamp) {
+			order.erase(it->second);
+			entries.erase(it);
+			return nullptr;
+		}
+		order.splice(order.begin(), order, it->second);
+		return it->second->mesh;
+	}
+
+	void Insert(const std::string& path, const FileStamp& stamp, std::shared_ptr<const MatrixMesh> mesh)
+	{
+		if (capacity == 0) {
+			return;
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = entries.find(path);
+		if (it != entries.end()) {
+			order.erase(it->second);
+			entries.erase(it);
+		}
+		order.push_front({ path, stamp, std::move(mesh) });
+		entries[path] = order.begin();
+		while (order.size() > capacity) {
+			entries.erase(order.back().path);
+			order.pop_back();
+		}
+	}
+
+private:
+	struct Entry
+	{
+		std::string path;
+		FileStamp stamp;
+		std::shared_ptr<const MatrixMesh> mesh;
+	};
+	size_t capacity;
+	std::mutex mutex;
+	std::list<Entry> order;
+	std::unordered_map<std::string, std::list<Entry>::iterator> entries;
+};
+
+#ifndef _WIN32
+namespace server_internal
+{
+	inline bool readAll(int fd, void* data, size_t n)
+	{
+		char* p = static_cast<char*>(data);
+		while (n > 0) {
+			ssize_t r = read(fd, p, n);
+			if (r <= 0) {
+				return false;
+			}
+			p += r;
+			n -= r;
+		}
+		return true;
+	}
+
+	inline bool writeAll(int fd, const void* data, size_t n)
+	{
+		const char* p = static_cast<const char*>(data);
+		while (n > 0) {
+			ssize_t r = send(fd, p, n, MSG_NOSIGNAL);
+			if (r <= 0) {
+				return false;
+			}
+			p += r;
+			n -= r;
+		}
+		return true;
+	}
+
+	inline uint64_t microseconds(std::chrono::steady_clock::time_point t0)
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t0).count();
+	}
+
+	inline bool fileStamp(const std::string& path, FileStamp& stamp)
+	{
+		struct stat st;
+		if (stat(path.c_str(), &st) != 0) {
+			return false;
+		}
+		stamp.size = (uint64_t)st.st_size;
+#ifdef __APPLE__
+		stamp.mtime_ns = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+		stamp.mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+		return true;
+	}
+}
+
+// Long-running load + remap + export service on a Unix domain socket.
+//
+// Run polls the listening socket and every idle connection; a connection
+// with a pending request is queued for a fixed pool of worker threads, which
+// serve that one request and hand the connection back to the poll set. Idle
+// clients therefore never hold a worker. Each worker keeps its own
+// RemapScratch so the remap buffers stay allocated between jobs (except for
+// RemapFlagLowMemory jobs, which free them).
+class RemapServer
+{
+public:
+	RemapServer(const std::string& socket_path, int workers = 4, size_t cache_size = 16)
+		: socket_path(socket_path), n_workers(std::max(1, workers)), cache(cache_size)
+	{}
+
+	~RemapServer()
+	{
+		Stop();
+	}
+
+	// Serve until Stop is called. Returns false if the socket cannot be opened.
+	bool Run()
+	{
+		listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (listen_fd < 0) {
+			return false;
+		}
+		sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if (socket_path.size() >= sizeof(addr.sun_path)) {
+			close(listen_fd);
+			return false;
+		}
+		strcpy(addr.sun_path, socket_path.c_str());
+		unlink(socket_path.c_str());
+		if (bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd, 64) < 0) {
+			close(listen_fd);
+			return false;
+		}
+
+		if (pipe(wake_fds) < 0) {
+			close(listen_fd);
+			return false;
+		}
+
+		running = true;
+		std::vector<std::thread> pool;
+		for (int i = 0; i < n_workers; i++) {
+			pool.emplace_back([this]() { Worker(); });
+		}
+		std::vector<int> idle;
+		std::vector<pollfd> fds;
+		while (running) {
+			fds.clear();
+			fds.push_back({ listen_fd, POLLIN, 0 });
+			fds.push_back({ wake_fds[0], POLLIN, 0 });
+			for (int fd : idle) {
+				fds.push_back({ fd, POLLIN, 0 });
+			}
+			if (poll(fds.data(), fds.size(), -1) < 0) {
+				continue;
+			}
+			if (fds[1].revents) {
+				char buf[64];
+				(void)read(wake_fds[0], buf, sizeof(buf));
+			}
+			std::vector<int> still_idle;
+			{
+				std::lock_guard<std::mutex> lock(queue_mutex);
+				for (size_t k = 2; k < fds.size(); k++) {
+					if (fds[k].revents) {
+						ready.push_back(fds[k].fd);
+						queue_cv.notify_one();
+					}
+					else {
+						still_idle.push_back(fds[k].fd);
+					}
+				}
+				still_idle.insert(still_idle.end(), returned.begin(), returned.end());
+				returned.clear();
+			}
+			idle.swap(still_idle);
+			if (fds[0].revents) {
+				int fd = accept(listen_fd, nullptr, nullptr);
+				if (fd >= 0) {
+					// a client that stalls inside a request cannot block a worker for long
+					timeval timeout{ 10, 0 };
+					setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+					idle.push_back(fd);
+				}
+			}
+		}
+		queue_cv.notify_all();
+		for (auto& t : pool) {
+			t.join();
+		}
+		for (int fd : idle) { close(fd); }
+		for (int fd : ready) { close(fd); }
+		for (int fd : returned) { close(fd); }
+		ready.clear();
+		returned.clear();
+		close(listen_fd);
+		close(wake_fds[0]);
+		close(wake_fds[1]);
+		unlink(socket_path.c_str());
+		return true;
+	}
+
+	void Stop()
+	{
+		if (running.exchange(false)) {
+			Wake();
+			queue_cv.notify_all();
+		}
+	}
+
+private:
+	// interrupt the poll of Run
+	void Wake()
+	{
+		char c = 0;
+		(void)write(wake_fds[1], &c, 1);
+	}
+
+	void Worker()
+	{
+		RemapScratch scratch;
+		while (true) {
+			int fd;
+			{
+				std::unique_lock<std::mutex> lock(queue_mutex);
+				queue_cv.wait(lock, [this]() { return !ready.empty() || !running; });
+				if (!running) {
+					return;
+				}
+				fd = ready.front();
+				ready.pop_front();
+			}
+			if (!Serve(fd, scratch)) {
+				close(fd);
+				continue;
+			}
+			std::lock_guard<std::mutex> lock(queue_mutex);
+			returned.push_back(fd);
+			Wake();
+		}
+	}
+
+	// Serve one request. Returns false when the connection is done (closed by
+	// the client, broken or sent a bad request).
+	bool Serve(int fd, RemapScratch& scratch)
+	{
+		RemapRequest req;
+		if (!server_internal::readAll(fd, &req, sizeof(req))) {
+			return false;
+		}
+		RemapReply reply;
+		memset(&reply, 0, sizeof(reply));
+		if (req.magic != RemapMagic || req.path_len > 4096 || req.out_len > 4096) {
+			reply.status = RemapStatusBadRequest;
+			server_internal::writeAll(fd, &reply, sizeof(reply));
+			return false;
+		}
+		std::string in_path(req.path_len, '\0'), out_path(req.out_len, '\0');
+		if ((req.path_len && !server_internal::readAll(fd, &in_path[0], req.path_len)) ||
+			(req.out_len && !server_internal::readAll(fd, &out_path[0], req.out_len))) {
+			return false;
+		}
+		if (req.op == RemapOpRemap) {
+			Job(in_path, out_path, req.flags, scratch, reply);
+		}
+		else if (req.op != RemapOpStats) {
+			reply.status = RemapStatusBadRequest;
+		}
+		{
+			std::lock_guard<std::mutex> lock(stats_mutex);
+			reply.jobs = jobs;
+			reply.mean_us = jobs ? total_us / jobs : 0;
+			reply.max_us = max_us;
+		}
+		return server_internal::writeAll(fd, &reply, sizeof(reply));
+	}
+
+	void Job(const std::string& in_path, const std::string& out_path, uint32_t flags, RemapScratch& scratch, RemapReply& reply)
+	{
+		auto t0 = std::chrono::steady_clock::now();
+		FileStamp stamp;
+		const bool found = server_internal::fileStamp(in_path, stamp);
+		std::shared_ptr<const MatrixMesh> loaded = found ? cache.Find(in_path, stamp) : nullptr;
+		reply.cache_hit = loaded != nullptr;
+		if (!loaded) {
+			objl::Loader loader;
+			if (!found || !loader.LoadFile(in_path)) {
+				reply.status = RemapStatusLoadFailed;
+				return;
+			}
+			auto m = std::make_shared<MatrixMesh>();
+			loader.GetLoadedVerts(m->V, m->N, m->TC);
+			loader.GetAllTriangleIndices(m->F, m->FTC, m->FN, m->FM);
+			loader.GetAllPolygonIndices(m->FP);
+			// cached meshes are sanitized once, when loaded
+			ValidationReport report;
+			if (!validateMesh(*m, report)) {
+				report.Print(in_path.c_str());
+				if (!sanitizeMesh(*m, report)) {
+					reply.status = RemapStatusInvalidMesh;
+					return;
+				}
+			}
+			loaded = m;
+			cache.Insert(in_path, stamp, loaded);
+		}
+		reply.load_us = server_internal::microseconds(t0);
+
+		auto t1 = std::chrono::steady_clock::now();
+		MatrixMesh mesh = *loaded;
+		if (flags & RemapFlagLowMemory) {
+			remapMeshLowMemory(mesh);
+		}
+		else {
+			remapMesh(mesh, nullptr, &scratch);
+		}
+		reply.remap_us = server_internal::microseconds(t1);
+		reply.vertices = (uint32_t)mesh.V.rows();
+		reply.faces = (uint32_t)mesh.F.rows();
+
+		auto t2 = std::chrono::steady_clock::now();
+		if (!out_path.empty() && !igl::writeOBJ(out_path, mesh.V, mesh.F, mesh.N, mesh.FN, mesh.TC, mesh.FTC)) {
+			reply.status = RemapStatusWriteFailed;
+		}
+		reply.write_us = server_internal::microseconds(t2);
+		reply.total_us = server_internal::microseconds(t0);
+
+		std::lock_guard<std::mutex> lock(stats_mutex);
+		jobs++;
+		total_us += reply.total_us;
+		max_us = std::max(max_us, reply.total_us);
+		printf("[remap server] %s: %u vertices, %u faces, load %.1f ms%s, remap %.1f ms, write %.1f ms\n",
+			in_path.c_str(), reply.vertices, reply.faces, reply.load_us / 1000.0, reply.cache_hit ? " (cached)" : "",
+			reply.remap_us / 1000.0, reply.write_us / 1000.0);
+		fflush(stdout);
+	}
+
+	std::string socket_path;
+	int n_workers;
+	int listen_fd = -1;
+	std::atomic<bool> running{ false };
+
+	int wake_fds[2] = { -1, -1 };
+
+	// connections with a pending request, and connections served by a
+	// worker that go back to the poll set
+	std::mutex queue_mutex;
+	std::condition_variable queue_cv;
+	std::deque<int> ready;
+	std::vector<int> returned;
+
+	MeshCache cache;
+
+	std::mutex stats_mutex;
+	uint64_t jobs = 0, total_us = 0, max_us = 0;
+};
+
+// Send one request to a running RemapServer and wait for the reply
+inline bool submitRemapJob(const std::string& socket_path, uint32_t op, const std::string& in_path,
+	const std::string& out_path, uint32_t flags, RemapReply& reply)
+{
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return false;
+	}
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+	if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return false;
+	}
+	RemapRequest req{ RemapMagic, op, flags, (uint32_t)in_path.size(), (uint32_t)out_path.size() };
+	bool ok = server_internal::writeAll(fd, &req, sizeof(req)) &&
+		server_internal::writeAll(fd, in_path.data(), in_path.size()) &&
+		server_internal::writeAll(fd, out_path.data(), out_path.size()) &&
+		server_internal::readAll(fd, &reply, sizeof(reply));
+	close(fd);
+	return ok;
+}
+#endif
@@ -0,0 +1,27 @@
+#pragma once
+#include <atomic>
+#include <functional>
+
+// Cooperative cancellation and progress reporting for long running calls
+// (LoadFile, remapMesh, ...). Both members are optional.
+struct TaskControl
+{
+	// set to true from any thread to stop at the next checkpoint
+	std::atomic<bool>* cancel = nullptr;
+	// fraction done in [0, 1], called from the working thread
+	std::function<void(float)> progress;
+
+	bool Cancelled() const
+	{
+		return cancel && cancel->load(std::memory_order_relaxed);
+	}
+
+	// Report progress, returns false if the task should stop
+	bool Checkpoint(float fraction) const
+	{
+		if (progress) {
+			progress(fraction);
+		}
+		return !Cancelled();
+	}
+};
@@ -1,118 +1,232 @@
 #include <iostream>
 #include <vector>
+#include <chrono>
 #include <DirectXMath.h>
 #include "OBJ_Loader.h"
-#include <igl/per_vertex_normals.h>
+#include "MeshRemap.h"
+#include "MeshTangents.h"
+#include "MeshSimplify.h"
+#include "MeshBake.h"
+#include "MeshMaterials.h"
+#include "MeshValidate.h"
+#include "MeshAdjacency.h"
+#include "MeshPartition.h"
+#include "MeshReweld.h"
+#include "MeshSpatialIndex.h"
+#include "MeshAsync.h"
+#include "ObjWatch.h"
+#include "RemapServer.h"
 
 #pragma comment(lib, "igl.lib")
 
-struct MatrixMesh
+static bool loadAndRemap(objl::Loader& obj_loader, const std::string& obj_fn, MatrixMesh& mesh, bool low_memory, bool strict)
 {
-	Eigen::MatrixXd V, N, TC;
-	Eigen::MatrixXi F, FN, FTC;
-};
-
-void remapMesh(MatrixMesh& mesh_cpu)
-{
-	auto& f = mesh_cpu.F;
-	auto& ftc = mesh_cpu.FTC;
-
-	std::vector<int> v_index(mesh_cpu.V.rows());
-	for (int i = 0; i < mesh_cpu.V.rows(); i++) { v_index[i] = i; }
-	std::vector<std::vector<int>> v_tc_index(mesh_cpu.V.rows());
-
-	for (int i = 0; i < f.rows(); i++) {
-		for (int j = 0; j < 3; j++) {
-			int f_Index = f(i, j);
-			int ftc_Index = ftc(i, j);
-			auto iter1 = find(v_tc_index[f_Index].begin(), v_tc_index[f_Index].end(), ftc_Index);
-			if (iter1 == v_tc_index[f_Index].end()) {
-				v_tc_index[f_Index].emplace_back(ftc_Index);
-			}
-		}
-	}
-
-	std::vector<int> v_tc_count(mesh_cpu.V.rows());
-	std::vector<int> v_tc_start(mesh_cpu.V.rows());
-	int count = 0;
-	for (int i = 0; i < v_tc_index.size(); i++) {
-		v_tc_count[i] = v_tc_index[i].size();
-		v_tc_start[i] = count;
-		count += v_tc_index[i].size();
+	bool ret = obj_loader.LoadFile(obj_fn);
+	if (!ret) {
+		printf("load obj: %s failed\n", obj_fn.c_str());
+		return false;
 	}
+	mesh = MatrixMesh();
+	obj_loader.GetLoadedVerts(mesh.V, mesh.N, mesh.TC);
+	obj_loader.GetLoadedColors(mesh.C);
+	obj_loader.GetAllTriangleIndices(mesh.F, mesh.FTC, mesh.FN, mesh.FM);
+	obj_loader.GetAllPolygonIndices(mesh.FP);
 
-	Eigen::MatrixXd v_new, tc_new;
-	Eigen::MatrixXi f_new;
-	v_new.resize(mesh_cpu.TC.rows(), 3);
-	tc_new.resize(mesh_cpu.TC.rows(), 2);
-	f_new.resize(mesh_cpu.F.rows(), 3);
-	count = 0;
-	std::vector<int> vNew2vOld(mesh_cpu.TC.rows());
-	std::vector<int> vNew2TcOld(mesh_cpu.TC.rows());
-	for (int i = 0; i < v_tc_index.size(); i++) {
-		for (int j = 0; j < v_tc_index[i].size(); j++) {
-			int tc_index = v_tc_index[i][j];
-			tc_new.row(count) = mesh_cpu.TC.row(tc_index);
-
-			vNew2vOld[count] = i;
-			vNew2TcOld[count] = tc_index;
-			count++;
+	ValidationReport report;
+	if (!validateMesh(mesh, report)) {
+		report.Print(obj_fn.c_str());
+		if (strict || !sanitizeMesh(mesh, report)) {
+			return false;
 		}
 	}
-	//count = 0;
-	for (int i = 0; i < mesh_cpu.V.rows(); i++) {
-		int count1 = 0;
-		for (int j = 0; j < v_tc_count[i]; j++) {
-			v_new.row(v_tc_start[i] + count1) = mesh_cpu.V.row(i);
-			count1++;
-		}
+	
+	if (mesh.C.rows() > 0) {
+		remapMeshWithColors(mesh, nullptr, low_memory);
 	}
-
-	for (int i = 0; i < mesh_cpu.F.rows(); i++) {
-		for (int j = 0; j < 3; j++) {
-			int v_index = mesh_cpu.F(i, j);
-			int tc_index = mesh_cpu.FTC(i, j);
-			int start_idx = v_tc_start[v_index];
-			int count = v_tc_count[v_index];
-			int exist = false;
-			for (int k = 0; k < count; k++) {
-				int idx = start_idx + k;
-				if (vNew2vOld[idx] == v_index && vNew2TcOld[idx] == tc_index) {
-					f_new(i, j) = idx;
-					exist = true;
-				}
-			}
-			if (!exist) {
-				printf("F(%d,%d) Wrong!\n", i, j);
-			}
-		}
+	else if (low_memory) {
+		remapMeshLowMemory(mesh);
 	}
-	mesh_cpu.F = f_new;
-	mesh_cpu.FTC = f_new;
-	mesh_cpu.V = v_new;
-	mesh_cpu.TC = tc_new;
-
-	//recalculate normal
-	igl::per_vertex_normals(mesh_cpu.V, mesh_cpu.F, mesh_cpu.N);
-	mesh_cpu.FN = mesh_cpu.F;
+	else {
+		remapMesh(mesh);
+	}
+	return true;
 }
 
 int main(int argc, char**argv)
 {
-	std::string obj_fn = argc > 1 ? argv[1] : "";
+	std::string obj_fn;
+	bool low_memory = false;
+	bool strict = false;
+	bool build_lods = false;
+	bool watch = false;
+	bool adjacency = false;
+	bool partition16 = false;
+	bool reweld = false;
+	bool query = false;
+	bool async = false;
+	int bake_size = 0;
+	std::string serve_socket, submit_socket;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--low-memory") { low_memory = true; }
+		else if (arg == "--strict") { strict = true; }
+		else if (arg == "--lod") { build_lods = true; }
+		else if (arg == "--watch") { watch = true; }
+		else if (arg == "--adjacency") { adjacency = true; }
+		else if (arg == "--partition16") { partition16 = true; }
+		else if (arg == "--reweld") { reweld = true; }
+		else if (arg == "--query") { query = true; }
+		else if (arg == "--async") { async = true; }
+		else if (arg == "--bake" && i + 1 < argc) { bake_size = atoi(argv[++i]); }
+		else if (arg == "--serve" && i + 1 < argc) { serve_socket = argv[++i]; }
+		else if (arg == "--submit" && i + 1 < argc) { submit_socket = argv[++i]; }
+		else { obj_fn = arg; }
+	}
+	if (!serve_socket.empty() || !submit_socket.empty()) {
+#ifdef _WIN32
+		printf("[remap server][ERROR] --serve / --submit need Unix domain sockets\n");
+		return -1;
+#else
+		if (!serve_socket.empty()) {
+			RemapServer server(serve_socket, (int)std::thread::hardware_concurrency());
+			return server.Run() ? 0 : -1;
+		}
+#endif
+	}
 	if (obj_fn.empty()) { return -1; }
+#ifndef _WIN32
+	if (!submit_socket.empty()) {
+		RemapReply reply;
+		std::string out_fn = obj_fn.substr(0, obj_fn.size() - 4) + "_remap.obj";
+		uint32_t flags = low_memory ? (uint32_t)RemapFlagLowMemory : 0u;
+		if (!submitRemapJob(submit_socket, RemapOpRemap, obj_fn, out_fn, flags, reply)) {
+			printf("submit to %s failed\n", submit_socket.c_str());
+			return -1;
+		}
+		printf("status %u: %u vertices, %u faces, %.1f ms%s (server: %llu jobs, mean %.1f ms)\n", reply.status, reply.vertices,
+			reply.faces, reply.total_us / 1000.0, reply.cache_hit ? " cached" : "", (unsigned long long)reply.jobs, reply.mean_us / 1000.0);
+		return reply.status == RemapStatusOk ? 0 : -1;
+	}
+#endif
 	
 	objl::Loader obj_loader;
-	bool ret = obj_loader.LoadFile(obj_fn);
-	if (!ret) {
-		printf("load obj: %s failed\n", obj_fn.c_str());
+	MatrixMesh mesh;
+	if (!loadAndRemap(obj_loader, obj_fn, mesh, low_memory, strict)) {
 		return -1;
 	}
-	MatrixMesh mesh;
-	obj_loader.GetLoadedVerts(mesh.V, mesh.N, mesh.TC);
-	obj_loader.LoadedMeshes[0].GetTriangleIndices(mesh.F, mesh.FTC, mesh.FN);
-	
-	remapMesh(mesh);
+	if (async) {
+		// same load + remap as tasks, and a remap cancelled before it starts
+		Executor executor = threadExecutor();
+		AsyncMesh loaded = LoadAsync(executor, obj_fn).get();
+		MatrixMesh copy = loaded.mesh;
+		AsyncMesh remapped = RemapAsync(executor, std::move(loaded.mesh), low_memory).get();
+		CancelToken cancel = makeCancelToken();
+		*cancel = true;
+		AsyncMesh cancelled = RemapAsync(executor, std::move(copy), low_memory, cancel).get();
+		bool same = remapped.status == TaskStatus::Done && remapped.mesh.V.rows() == mesh.V.rows() &&
+			remapped.mesh.F.rows() == mesh.F.rows() && remapped.mesh.V == mesh.V && remapped.mesh.F == mesh.F;
+		printf("async: %d vertices, %d faces, %s the synchronous remap; cancelled task %s\n", int(remapped.mesh.V.rows()),
+			int(remapped.mesh.F.rows()), same ? "same as" : "DIFFERENT from",
+			cancelled.status == TaskStatus::Cancelled ? "stopped" : "did not stop");
+	}
+	computeTangents(mesh);
+
+	std::vector<DrawRange> draw_ranges;
+	sortFacesByMaterial(mesh, draw_ranges);
+	for (auto& r : draw_ranges) {
+		printf("material %s: faces %d - %d\n", r.material >= 0 ? obj_loader.MaterialNames[r.material].c_str() : "(none)",
+			r.first_face, r.first_face + r.face_count);
+	}
+
+	if (adjacency) {
+		MeshAdjacency adj;
+		buildAdjacency(mesh, adj);
+		int borders = (int)std::count(adj.FF.begin(), adj.FF.end(), -1);
+		printf("adjacency: %d border half edges, %d seam edges\n", borders, int(adj.SeamEdges.size() / 4));
+	}
+	if (partition16) {
+		PartitionedMesh16 parts;
+		partitionMesh16(mesh, parts);
+		printf("16-bit partition: %d parts, %d vertices (%d duplicated)\n", int(parts.Parts.size()), int(parts.V.rows()), parts.Duplicated);
+	}
+	if (reweld) {
+		MatrixMesh welded = mesh;
+		if (reweldMesh(welded)) {
+			printf("reweld: %d positions, %d texcoords (loaded %d, %d)\n", int(welded.V.rows()), int(welded.TC.rows()),
+				int(obj_loader.LoadedPositions.size()), int(obj_loader.LoadedTCoords.size()));
+		}
+	}
+	if (query) {
+		// UV centroid of every face, and every vertex position
+		UVIndex uv_index;
+		SurfaceIndex surface_index;
+		buildUVIndex(mesh, uv_index);
+		buildSurfaceIndex(mesh, surface_index);
+		const int nf = (int)mesh.F.rows(), nv = (int)mesh.V.rows();
+		std::vector<float> u(nf), v(nf), x(nv), y(nv), z(nv), dist(std::max(nf, nv));
+		std::vector<int32_t> tri(std::max(nf, nv));
+		std::vector<float> b1(tri.size()), b2(tri.size());
+		for (int i = 0; i < nf; i++) {
+			Eigen::RowVector2d c = (mesh.TC.row(mesh.F(i, 0)) + mesh.TC.row(mesh.F(i, 1)) + mesh.TC.row(mesh.F(i, 2))) / 3.0;
+			u[i] = (float)c.x();
+			v[i] = (float)c.y();
+		}
+		for (int i = 0; i < nv; i++) {
+			x[i] = (float)mesh.V(i, 0);
+			y[i] = (float)mesh.V(i, 1);
+			z[i] = (float)mesh.V(i, 2);
+		}
+		SurfaceQueryResult out{ tri.data(), b1.data(), b2.data(), dist.data() };
+		queryUV(uv_index, nf, u.data(), v.data(), out);
+		int own = 0;
+		for (int i = 0; i < nf; i++) { own += tri[i] == i; }
+		queryNearestSurface(surface_index, nv, x.data(), y.data(), z.data(), out);
+		float max_dist = nv ? *std::max_element(dist.begin(), dist.begin() + nv) : 0.0f;
+		printf("query: %d of %d UV centroids on their own face, vertices at most %g from the surface\n", own, nf, max_dist);
+	}
+	if (build_lods) {
+		std::vector<MatrixMesh> lods;
+		buildLodChain(mesh, { 0.5, 0.25, 0.125 }, lods);
+		for (size_t i = 0; i < lods.size(); i++) {
+			printf("lod %d: %d vertices, %d triangles\n", int(i + 1), int(lods[i].V.rows()), int(lods[i].F.rows()));
+		}
+	}
+	if (bake_size > 0) {
+		BakeMaps maps;
+		bakeUVMaps(mesh, bake_size, bake_size, maps, 4);
+		std::string base = obj_fn.substr(0, obj_fn.size() - 4);
+		writePFM(base + "_position.pfm", maps.position, maps.width, maps.height, 3);
+		writePFM(base + "_normal.pfm", maps.normal, maps.width, maps.height, 3);
+		writeTriangleMap(base + "_triangle.raw", maps);
+	}
 	printf("done!!!\n");
+
+	if (watch) {
+		ObjSnapshot snapshot;
+		snapshotObj(obj_fn, snapshot);
+		watchFile(obj_fn, [&]() {
+			auto t0 = std::chrono::steady_clock::now();
+			int changed = 0;
+			if (updatePositions(obj_fn, snapshot, obj_loader, &changed)) {
+				regatherPositions(mesh, obj_loader);
+				computeTangents(mesh);
+				printf("positions updated (%d chunks)", changed);
+			}
+			else {
+				if (!loadAndRemap(obj_loader, obj_fn, mesh, low_memory, strict)) {
+					// the loader is cleared, the next save has to reload fully
+					snapshot.chunks.clear();
+					return true;
+				}
+				computeTangents(mesh);
+				snapshotObj(obj_fn, snapshot);
+				printf("reloaded");
+			}
+			double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+			printf(" in %.1f ms\n", ms);
+			fflush(stdout);
+			return true;
+		});
+	}
 	return 0;
 }
\ No newline at end of file